@@ -48,10 +48,36 @@
  * - Exemplo de animação em C no terminal
  *
  * Compilação:
- *     gcc supernova.c -o supernova -lm
+ *     gcc -O3 supernova.c -o supernova -lm -pthread
+ *
+ *     Com -O3 (ou -O2 -ftree-vectorize) o GCC e o Clang vetorizam a
+ *     atualização das partículas; -march=native habilita AVX/AVX2.
  *
  * Execução:
- *     ./supernova
+ *     ./supernova [--width N] [--height N] [--particles N] [--aspect F]
+ *
+ *     Sem --width/--height a grade acompanha o tamanho do terminal,
+ *     inclusive quando a janela é redimensionada.
+ *
+ *     ./supernova --record arquivo.snv
+ *     ./supernova --play arquivo.snv
+ *
+ *     Grava os frames exibidos em um arquivo binário compacto e os
+ *     reproduz depois com o mesmo ritmo da execução original.
+ *
+ *     ./supernova --play arquivo.snv --seek 12.5
+ *     ./supernova --play arquivo.snv --seek EXPLOSION:2
+ *
+ *     Começa a reprodução em um instante (segundos) ou no início de uma
+ *     fase (opcionalmente a n-ésima ocorrência), sem decodificar o resto.
+ *
+ *     ./supernova --bench N
+ *
+ *     Executa N frames sem terminal e sem pausas (renderização em
+ *     memória) e relata o custo de atualização e renderização por fase.
+ *     As mesmas opções podem vir do ambiente: SUPERNOVA_WIDTH,
+ *     SUPERNOVA_HEIGHT, SUPERNOVA_PARTICLES e SUPERNOVA_ASPECT.
+ *     A linha de comando tem precedência sobre o ambiente.
  *
  * Requisitos:
  * - GCC ou Clang
@@ -66,161 +92,3215 @@
  * Projeto aberto para estudo, colaboração e evolução.
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <math.h>
-#include <unistd.h>
-#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+
+// Grade de referência: toda a física de update_star é expressa nessas
+// unidades e escalada para a grade escolhida apenas na renderização
+#define BASE_WIDTH 90
+#define BASE_HEIGHT 32
+
+#define DEFAULT_WIDTH BASE_WIDTH
+#define DEFAULT_HEIGHT BASE_HEIGHT
+#define DEFAULT_PARTICLES 450
+#define DEFAULT_ASPECT 1.5f      // Correção da proporção vertical do terminal
+
+#define MAX_DIM 9999             // Limite de "\033[rrrr;ccccH"
+#define MAX_PARTICLES (1 << 26)
+#define MAX_PROCEDURAL_PARTICLES (1 << 30)   // --procedural: nada é alocado
+
+#define CACHE_LINE 64
+
+#define MAX_THREADS 256
+
+#define RING_SLOTS 4             // Frames em trânsito para a thread de saída
+
+#define FPS 30                   // Passos de física por segundo (dt fixo = 1/FPS)
+
+// Maior atraso que o laço recupera de uma vez; acima disso (processo
+// suspenso com Ctrl-Z, máquina em hibernação) o excedente é descartado
+#define MAX_CATCHUP_NS (5ull * 1000000000ull)
+
+// Durações das fases na forma fechada (--analytic); a do colapso
+// depende do raio no fim da fase GIANT e é calculada em star_at
+#define GIANT_TIME 5.0
+#define BOUNCE_TIME 0.8
+#define EXPLOSION_TIME (29.0 / 30)   // Choque de 3 a 32 a 30/s
+#define NEBULA_TIME (10.0 / 6)       // Nebulosa de 32 a 42 a 6/s
+
+// Estados evolutivos da estrela
+#define GIANT 0
+#define COLLAPSE 1
+#define BOUNCE 2
+#define EXPLOSION 3
+#define NEBULA 4
+
+static const char *state_names[] = { "GIANT", "COLLAPSE", "BOUNCE", "EXPLOSION", "NEBULA" };
+
+/**
+ * Partículas em layout de estrutura de arrays (SoA): cada campo é um
+ * array contíguo e alinhado, o que permite ao compilador processar
+ * vários elementos por instrução (SSE/AVX/NEON) na atualização.
+ * A posição é relativa ao centro da estrela, em unidades da grade de
+ * referência.
+ *
+ * Invariante: as partículas [0, count) estão todas vivas (life > 0).
+ * As que morrem são removidas logo após a integração, então atualização
+ * e renderização custam proporcionalmente às partículas vivas.
+ *
+ * Na forma fechada (--analytic) só vx, vy e life (vida inicial) são
+ * usados: nada é escrito depois do lançamento, a posição é vx*idade e a
+ * partícula está viva enquanto life > idade (ver Star::age).
+ * No modo procedural (--procedural) nem isso é guardado: os vetores
+ * ficam vazios e count é apenas o número de partículas lançadas.
+ */
+typedef struct {
+    float *x, *y;
+    float *vx, *vy;
+    float *life;
+    int count;
+    int capacity;
+} Particles;
+
+typedef struct {
+    float radius;            // Raio visível da estrela
+    float core_radius;       // Tamanho do núcleo compacto (estrela de nêutrons)
+    float explosion_radius;  // Raio da frente de choque da supernova
+    float velocity;          // Velocidade de contração durante colapso
+    float time;              // Tempo interno do estágio
+    float density;           // (Reservado para futuras expansões científicas)
+    int state;
+
+    uint64_t seed;           // Semente do gerador (--seed)
+    uint64_t tick;           // Passos de física desde o início
+    uint64_t cycle;          // Explosões desde o início
+
+    int analytic;            // Forma fechada (--analytic): ver star_at
+    int procedural;          // Partículas sem armazenamento (--procedural)
+    double clock;            // Tempo simulado absoluto, em segundos
+    float age;               // Idade das partículas na forma fechada
+    uint64_t spawn_key;      // Chave do último lançamento (procedural)
+
+    Particles particles;     // Bloco alinhado alocado uma vez no início
+
+} Star;
+
+// Sequências ANSI usadas na saída
+#define ANSI_HOME "\033[H"
+#define ANSI_CLEAR "\033[H\033[J"
+#define ANSI_RESET "\033[0m"
+#define ANSI_ERASE_LINE "\033[K"
+
+// Maior sequência de posicionamento possível: "\033[rrrr;ccccH"
+#define MAX_MOVE_BYTES 12
+
+// Linha de estado (--status), na linha do terminal abaixo da imagem
+#define STATUS_COLS 120
+#define STATUS_BYTES (MAX_MOVE_BYTES + sizeof(ANSI_RESET) + STATUS_COLS + sizeof(ANSI_ERASE_LINE))
+
+// Cores (--color): cada célula guarda o índice de uma paleta fixa,
+// convertido em SGR conforme a capacidade do terminal
+#define COLOR_DEFAULT 0
+#define HEAT_BASE 1                             // Temperatura: vermelho → branco → azul
+#define HEAT_LEVELS 16
+#define NEBULA_BASE (HEAT_BASE + HEAT_LEVELS)   // Nebulosa: rosa → púrpura escuro
+#define NEBULA_LEVELS 8
+#define COLOR_COUNT (NEBULA_BASE + NEBULA_LEVELS)
+
+// Maior SGR de cor: "\033[38;2;rrr;ggg;bbbm"
+#define MAX_SGR_BYTES 19
+
+enum { COLOR_NONE, COLOR_16, COLOR_256, COLOR_TRUE };
+
+// Glifos (--charset): ASCII, ou uma célula dividida em subpixels cujos
+// bits acesos formam a máscara guardada em Frame::cells
+enum { CHARSET_ASCII, CHARSET_BRAILLE, CHARSET_HALF };
+
+// Densidade das partículas (--density): desligada (qualquer partícula
+// vira '+'), contagem por célula ou contagem ponderada pela vida restante
+enum { DENSITY_OFF, DENSITY_COUNT, DENSITY_LIFE };
+
+#define DENSITY_ONE 16           // Peso de uma partícula nova (ponto fixo)
+#define DENSITY_MAX (1u << 24)   // Os contadores saturam aqui
+#define DENSITY_BLOCK 256        // Partículas por bloco de índices
+
+// Rampa de intensidade: cada dobro de partículas sobe um degrau
+static const char density_ramp[] = " .:-=+*#%@";
+#define DENSITY_LEVELS ((int)sizeof(density_ramp) - 2)
+
+/**
+ * Tabela máscara → UTF-8 de um conjunto de subpixels de sx x sy por
+ * célula, montada uma vez por glyphs_init. A máscara 0 é o espaço.
+ */
+typedef struct {
+    int charset;
+    int sx, sy;                  // Subpixels por célula
+    char code[256][4];
+    uint8_t len[256];
+} Glyphs;
+
+// Bit de cada ponto braille (coluna dx, linha dy) no caractere U+2800
+static const uint8_t braille_bit[4][2] = {
+    { 0x01, 0x08 },
+    { 0x02, 0x10 },
+    { 0x04, 0x20 },
+    { 0x40, 0x80 },
+};
+
+/**
+ * Sequências SGR de cada cor da paleta no nível de cor do terminal
+ * (truecolor, 256 ou 16 cores), montadas uma vez por palette_init.
+ * Em 256 e 16 cores, vários índices viram a mesma sequência; canon
+ * leva cada índice ao primeiro com a mesma sequência, para que o
+ * codificador compare o que é de fato emitido. rank ordena as cores da
+ * mais fria à mais quente: a cor padrão, a nebulosa do púrpura escuro
+ * ao rosa e depois a rampa de temperatura.
+ */
+typedef struct {
+    int level;
+    char code[COLOR_COUNT][MAX_SGR_BYTES + 1];
+    uint8_t len[COLOR_COUNT];
+    uint8_t canon[COLOR_COUNT];
+    uint8_t rank[COLOR_COUNT];
+} Palette;
+
+/**
+ * Medições de um frame para --stats e --status, feitas no laço de
+ * simulação e levadas junto com a imagem até quem a entrega.
+ */
+typedef struct {
+    uint64_t frame;              // Número do frame renderizado
+    double clock;                // Tempo simulado, em segundos
+    int live;                    // Partículas vivas
+    int steps;                   // Passos de física desde o frame anterior
+    uint64_t update_ns;          // Duração desses passos
+    uint64_t render_ns;
+} FrameStats;
+
+/**
+ * Frame buffer da imagem completa.
+ * cells guarda o glifo de cada célula e prev o último frame enviado
+ * ao terminal; out é a saída serializada, enviada com um único write().
+ * A saída pode ser um repaint completo ou apenas as diferenças.
+ * Com paleta, colors e prev_colors fazem o mesmo para a cor de cada
+ * célula; sem ela, nem são alocados. Com glifos (braille ou meio
+ * bloco), cada célula guarda a máscara dos seus subpixels acesos.
+ */
+typedef struct {
+    int width, height;
+    char *cells;                 // width*height, linha a linha
+    char *prev;
+    int has_prev;                // prev é válido (já houve um frame enviado)
+    int needs_clear;             // Próximo repaint limpa a tela (novo tamanho)
+    char *out;
+    size_t full_bytes;           // Tamanho de um repaint completo (com cores ou glifos, o último)
+
+    uint8_t *colors;             // width*height índices da paleta, ou NULL
+    uint8_t *prev_colors;
+    const Palette *palette;      // NULL: monocromático
+    int pen;                     // Cor atual do terminal (0: padrão)
+    const Glyphs *glyphs;        // NULL: cells são caracteres ASCII
+
+    char *block;                 // Bloco único que contém todos os buffers
+    size_t block_cap;            // Capacidade do bloco (só cresce)
+
+    // Metadados da imagem atual, usados pela gravação
+    int state;                   // Fase exibida
+    uint64_t time_ns;            // Instante da renderização (relógio monotônico)
+    FrameStats stats;
+} Frame;
+
+/**
+ * Geometria da renderização: centro da grade, proporção das células e
+ * escala entre a grade de referência (BASE_WIDTH x BASE_HEIGHT) e a
+ * grade real. Raios e limiares de update_star ficam em unidades de
+ * referência, então crescem junto com a grade sem alterar a física.
+ *
+ * Como centro e grade só mudam em um redimensionamento, a distância de
+ * cada célula ao centro (já corrigida pela proporção e convertida para
+ * unidades de referência) e seu ângulo polar ficam em tabelas
+ * calculadas uma única vez; por frame resta apenas consultar e comparar.
+ */
+typedef struct {
+    int width, height;
+    float cx, cy;
+    float aspect;
+    float scale;
+    float yscale;                // Escala vertical das partículas
+    int subpixels;               // Subpixels por célula (1 em ASCII)
+
+    float *radius;               // width*height, distância ao centro
+    float *angle;                // width*height, ângulo polar em (-pi, pi]
+    size_t table_cap;            // Células que cabem nas tabelas (só cresce)
+} Geometry;
+
+/**
+ * Parâmetros de execução (linha de comando e ambiente)
+ */
+typedef struct {
+    int width, height;
+    int auto_width, auto_height; // Dimensão segue o tamanho do terminal
+    int particles;
+    float aspect;
+    int bench_frames;            // > 0: modo benchmark sem terminal
+    uint64_t seed;
+    int has_seed;                // --seed explícito
+    int threads;                 // Threads de renderização (--threads)
+    int sync_output;             // Escreve no laço de simulação (--sync)
+    const char *record_path;     // --record
+    const char *play_path;       // --play
+    const char *seek;            // --seek: segundos ou FASE[:n]
+    const char *asciicast_path;  // --asciicast
+    int headless;                // Sem terminal e sem esperas (--headless)
+    int max_frames;              // > 0: encerra após N frames (--frames)
+    int analytic;                // Evolução em forma fechada (--analytic)
+    int procedural;              // Partículas sem armazenamento (--procedural)
+    float speed;                 // Segundos simulados por segundo (--speed)
+    float start;                 // Instante inicial da simulação (--start)
+    int color;                   // COLOR_*, ou -1: detectar (--color)
+    int charset;                 // CHARSET_* (--charset)
+    int density;                 // DENSITY_* (--density)
+    const char *stats_path;      // --stats
+    int status;                  // Linha de estado (--status)
+    const char *trace_path;      // --trace
+} Config;
+
+/**
+ * Pool persistente de threads de renderização.
+ * A thread que chama pool_run é o trabalhador 0; as demais dormem em uma
+ * variável de condição entre um frame e outro. Cada trabalhador recebe
+ * uma faixa de linhas da imagem e uma fatia das partículas.
+ *
+ * As partículas de uma fatia podem cair em qualquer linha, então cada
+ * trabalhador marca as suas em um mapa de acertos privado (hits) e
+ * anota cada célula marcada pela primeira vez na lista da faixa que a
+ * contém (touched). Em uma segunda etapa cada faixa percorre apenas as
+ * listas de todos para as suas linhas, combina os acertos e zera de
+ * volta as células lidas: os mapas ficam zerados entre um frame e
+ * outro e o custo por trabalhador é O(N/T + células marcadas), sem
+ * limpar nem varrer W*H por thread. Nenhuma célula é escrita por duas
+ * threads e o resultado é idêntico ao da renderização em uma única
+ * thread. Com --density, os mapas são contadores de 32 bits (counts)
+ * combinados da mesma forma.
+ *
+ * A lista da faixa b de um trabalhador começa na primeira célula da
+ * faixa e tem espaço para todas as células dela, então nunca transborda.
+ */
+typedef struct RenderPool RenderPool;
+typedef void (*PoolJob)(void *ctx, int worker);
+
+struct RenderPool {
+    int nthreads;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;        // Novo trabalho publicado
+    pthread_cond_t done;         // Último trabalhador terminou
+    uint64_t generation;         // Incrementado a cada pool_run
+    int pending;                 // Trabalhadores ainda ocupados
+    int shutdown;
+    PoolJob job;
+    void *ctx;
+
+    uint8_t *hits;               // nthreads mapas de width*height, zerados entre frames
+    size_t hits_stride;          // Bytes entre dois mapas
+    size_t hits_cap;             // Células que cabem em cada mapa (só cresce)
+
+    int density;                 // DENSITY_* (--density)
+    uint32_t *counts;            // nthreads contadores de width*height + 1
+    size_t counts_stride;        // Contadores entre dois mapas
+    size_t counts_cap;           // Contadores que cabem em cada mapa (só cresce)
+
+    uint32_t *touched;           // nthreads listas de células marcadas, por faixa
+    size_t touched_stride;       // Entradas entre duas listas
+    size_t touched_cap;          // Entradas em cada lista (só cresce)
+    int *ntouched;               // nthreads x nthreads: marcadas por trabalhador e faixa
+};
+
+// Sinalizado por SIGWINCH; tratado no laço principal
+static volatile sig_atomic_t resize_pending = 0;
+
+// Sinalizado por SIGINT/SIGTERM: o laço principal encerra e finaliza
+// os arquivos de gravação
+static volatile sig_atomic_t quit_pending = 0;
+
+// Sinalizado por SIGUSR1 com --trace: o laço principal grava o trace
+static volatile sig_atomic_t trace_pending = 0;
+
+/**
+ * Gerador pseudoaleatório baseado em contador (SplitMix64).
+ * Cada número é uma função pura de (semente, fluxo, contador), sem
+ * estado global: a mesma execução se repete a partir da mesma semente e
+ * qualquer parte da sequência pode ser gerada em paralelo, por qualquer
+ * thread, sem coordenação.
+ *
+ * Fluxos usados: ejecta da explosão n usa o fluxo RNG_SPAWN(n); o ruído
+ * da nebulosa no passo t usa RNG_NOISE(t), indexado pela célula.
+ */
+#define RNG_SPAWN(cycle) ((uint64_t)(cycle) << 1)
+#define RNG_NOISE(tick)  (((uint64_t)(tick) << 1) | 1)
+
+static inline uint64_t mix64(uint64_t z){
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Chave de um fluxo independente da semente
+static inline uint64_t rng_key(uint64_t seed, uint64_t stream){
+    return mix64(seed ^ mix64(stream));
+}
+
+// n-ésimo número de 64 bits do fluxo
+static inline uint64_t rng_at(uint64_t key, uint64_t n){
+    return mix64(key + n * 0xd1b54a32d192ed03ull);
+}
+
+// 24 bits de r como float uniforme em [0, 1)
+static inline float rng_unit(uint64_t r){
+    return (float)(r & 0xffffff) * (1.0f / 16777216.0f);
+}
+
+// Função utilitária
+float clamp(float v, float a, float b){
+    if(v < a) return a;
+    if(v > b) return b;
+    return v;
+}
+
+/**
+ * Converte um inteiro em [lo, hi]; valores inválidos encerram o programa
+ */
+int parse_int(const char *name, const char *v, int lo, int hi){
+    char *end;
+    errno = 0;
+    long n = strtol(v, &end, 10);
+    if(errno || end == v || *end || n < lo || n > hi){
+        fprintf(stderr, "supernova: %s inválido: '%s' (esperado %d..%d)\n", name, v, lo, hi);
+        exit(2);
+    }
+    return (int)n;
+}
+
+float parse_float(const char *name, const char *v, float lo, float hi){
+    char *end;
+    errno = 0;
+    float n = strtof(v, &end);
+    if(errno || end == v || *end || !(n >= lo && n <= hi)){
+        fprintf(stderr, "supernova: %s inválido: '%s' (esperado %g..%g)\n", name, v, lo, hi);
+        exit(2);
+    }
+    return n;
+}
+
+uint64_t parse_u64(const char *name, const char *v){
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(v, &end, 0);
+    if(errno || end == v || *end || *v == '-'){
+        fprintf(stderr, "supernova: %s inválido: '%s'\n", name, v);
+        exit(2);
+    }
+    return n;
+}
+
+/**
+ * Alocação alinhada à linha de cache. Falha de memória é fatal:
+ * só acontece na inicialização, nunca durante a animação.
+ */
+void *alloc_aligned(size_t size){
+    void *p = NULL;
+    size = (size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    if(posix_memalign(&p, CACHE_LINE, size ? size : CACHE_LINE) != 0){
+        fprintf(stderr, "supernova: sem memória (%zu bytes)\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+/**
+ * Aloca os cinco arrays das partículas em um único bloco, cada um
+ * começando em sua própria linha de cache.
+ */
+void particles_init(Particles *p, int capacity){
+    size_t per_line = CACHE_LINE / sizeof(float);
+    size_t stride = ((size_t)capacity + per_line - 1) / per_line * per_line;
+    float *block = alloc_aligned(5 * stride * sizeof(float));
+
+    p->x = block;
+    p->y = block + stride;
+    p->vx = block + 2 * stride;
+    p->vy = block + 3 * stride;
+    p->life = block + 4 * stride;
+    p->count = 0;
+    p->capacity = capacity;
+}
+
+/**
+ * Dimensiona os buffers de um frame width x height. Todos vivem em um
+ * único bloco alinhado: cells, prev, colors, prev_colors (só com
+ * paleta) e out começam cada um em sua linha de cache. O bloco só
+ * cresce, então voltar a um tamanho já usado não aloca nada; o
+ * conteúdo anterior é descartado (has_prev = 0) e o próximo repaint
+ * limpa a tela, pois a imagem antiga pode ser maior.
+ */
+void frame_resize(Frame *f, int width, int height){
+    size_t ncells = (size_t)width * height;
+    size_t cells_sz = (ncells + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+
+    f->width = width;
+    f->height = height;
+    f->full_bytes = sizeof(ANSI_HOME) - 1 + (size_t)height * (width + 1);
+
+    // out comporta o repaint completo (com a limpeza de tela) ou uma
+    // diferença que o exceda em no máximo uma sequência (salto + linha);
+    // com cores, cada célula pode vir precedida de um SGR, e com glifos
+    // cada uma ocupa até 3 bytes em UTF-8
+    size_t glyph = (f->glyphs ? 3 : 1) + (f->palette ? MAX_SGR_BYTES : 0);
+    size_t out_sz = sizeof(ANSI_CLEAR) + (size_t)height * (width * glyph + 1)
+                    + MAX_MOVE_BYTES + width * glyph + 4    // + cópia fixa de um glifo
+                    + STATUS_BYTES;
+    size_t planes = f->palette ? 4 : 2;
+    size_t need = planes * cells_sz + out_sz;
+
+    if(need > f->block_cap){
+        // Folga de 50% para que redimensionamentos sucessivos da janela
+        // não provoquem uma realocação a cada passo
+        size_t cap = need + need / 2;
+        free(f->block);
+        f->block = alloc_aligned(cap);
+        f->block_cap = cap;
+    }
+
+    f->cells = f->block;
+    f->prev = f->block + cells_sz;
+    f->colors = f->palette ? (uint8_t *)f->block + 2 * cells_sz : NULL;
+    f->prev_colors = f->palette ? (uint8_t *)f->block + 3 * cells_sz : NULL;
+    f->out = f->block + planes * cells_sz;
+    f->has_prev = 0;
+    f->needs_clear = 1;
+}
+
+/**
+ * Tela de subpixels (--charset): só cells e, com paleta, colors, em um
+ * bloco que só cresce. É renderizada como um frame comum e depois
+ * compactada em máscaras por pack_cells.
+ */
+void canvas_resize(Frame *c, int width, int height){
+    size_t ncells = (size_t)width * height;
+    size_t cells_sz = (ncells + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    size_t need = (c->palette ? 2 : 1) * cells_sz;
+
+    if(need > c->block_cap){
+        size_t cap = need + need / 2;
+        free(c->block);
+        c->block = alloc_aligned(cap);
+        c->block_cap = cap;
+    }
+    c->width = width;
+    c->height = height;
+    c->cells = c->block;
+    c->colors = c->palette ? (uint8_t *)c->block + cells_sz : NULL;
+}
+
+/**
+ * Calcula a geometria de uma grade de cols x rows células, cada uma com
+ * subx x suby subpixels (1 x 1 em ASCII), e reconstrói a tabela polar.
+ * A grade renderizada é a de subpixels; a escala vem das células, para
+ * que a estrela tenha o mesmo tamanho na tela em qualquer modo. Como os
+ * buffers do frame, as tabelas só crescem.
+ */
+void set_geometry(Geometry *g, int cols, int rows, float aspect, int subx, int suby){
+    float sx = (float)cols / BASE_WIDTH;
+    float sy = (float)rows / BASE_HEIGHT;
+    float scale = sx < sy ? sx : sy;
+    int width = cols * subx, height = rows * suby;
+    size_t ncells = (size_t)width * height;
+
+    g->width = width;
+    g->height = height;
+    g->cx = width / 2.0;
+    g->cy = height / 2.0;
+    g->aspect = aspect * subx / suby;   // Proporção do subpixel
+    g->scale = scale * subx;
+    g->yscale = scale * suby;
+    g->subpixels = subx * suby;
+    aspect = g->aspect;
+
+    if(ncells > g->table_cap){
+        size_t cap = ncells + ncells / 2;
+        free(g->radius);
+        g->radius = alloc_aligned(2 * cap * sizeof(float));
+        g->table_cap = cap;
+    }
+    g->angle = g->radius + g->table_cap;
+
+    const float inv_scale = 1.0f / g->scale;
+    for(int y = 0; y < height; y++){
+        // Correção da proporção vertical do terminal
+        float dy = (y - g->cy) * aspect;
+        for(int x = 0; x < width; x++){
+            float dx = (x - g->cx);
+            g->radius[(size_t)y * width + x] = sqrt(dx*dx + dy*dy) * inv_scale;
+            g->angle[(size_t)y * width + x] = atan2f(dy, dx);
+        }
+    }
+}
+
+// Relógio monotônico em nanossegundos
+uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Trace do pipeline de frames (--trace), no formato de eventos do
+ * Chrome (chrome://tracing, Perfetto). Cada thread registrada grava
+ * seus trechos (início e duração) em um buffer próprio, sem travas:
+ * os trechos ficam em blocos de TRACE_CHUNK alocados sob demanda, e o
+ * contador publicado com release indica até onde o buffer é legível.
+ * Nada é sobrescrito, então o trace pode ser gravado com as threads
+ * ainda rodando (SIGUSR1). Passado TRACE_MAX_CHUNKS blocos, a thread
+ * só conta os trechos perdidos.
+ *
+ * Sem --trace nenhuma thread tem buffer e cada trecho custa apenas a
+ * leitura de um ponteiro local à thread.
+ */
+enum { TRACE_UPDATE, TRACE_PARTICLES, TRACE_RENDER, TRACE_LAYERS, TRACE_SPLAT,
+       TRACE_ENCODE, TRACE_FLUSH, TRACE_RECORD, TRACE_CAST };
+
+static const char *trace_names[] = {
+    [TRACE_UPDATE]    = "update",
+    [TRACE_PARTICLES] = "update_particles",
+    [TRACE_RENDER]    = "render",
+    [TRACE_LAYERS]    = "render_layers",
+    [TRACE_SPLAT]     = "render_particles",
+    [TRACE_ENCODE]    = "encode",
+    [TRACE_FLUSH]     = "flush",
+    [TRACE_RECORD]    = "record",
+    [TRACE_CAST]      = "asciicast",
+};
+
+#define TRACE_CHUNK 4096         // Trechos por bloco (64 KiB)
+#define TRACE_MAX_CHUNKS 256     // Até 1M trechos por thread
+
+typedef struct {
+    uint64_t begin_ns;
+    uint32_t dur_ns;
+    uint32_t kind;               // TRACE_*
+} TraceSpan;
+
+typedef struct {
+    int tid;
+    char name[32];
+    TraceSpan *chunks[TRACE_MAX_CHUNKS];
+    _Atomic size_t count;        // Trechos publicados
+    _Atomic uint64_t lost;       // Trechos que não couberam
+} TraceBuffer;
+
+static struct {
+    const char *path;            // NULL: desligado
+    uint64_t t0;                 // Origem dos instantes
+    pthread_mutex_t lock;        // Protege o registro das threads
+    int nthreads;
+    TraceBuffer *threads[MAX_THREADS + 2];
+} trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static _Thread_local TraceBuffer *trace_tls;
+
+// Registra a thread atual com o nome dado (sem efeito sem --trace)
+void trace_thread(const char *name){
+    if(!trace.path || trace_tls) return;
+
+    TraceBuffer *b = calloc(1, sizeof(*b));
+    if(!b) return;
+    snprintf(b->name, sizeof(b->name), "%s", name);
+
+    pthread_mutex_lock(&trace.lock);
+    if(trace.nthreads < MAX_THREADS + 2){
+        b->tid = trace.nthreads + 1;
+        trace.threads[trace.nthreads++] = b;
+        trace_tls = b;
+    }
+    pthread_mutex_unlock(&trace.lock);
+    if(!trace_tls) free(b);
+}
+
+// Início de um trecho: o instante atual, ou 0 se a thread não grava
+static inline uint64_t trace_begin(void){
+    return trace_tls ? now_ns() : 0;
+}
+
+// Fim do trecho kind iniciado em t0
+static inline void trace_end(int kind, uint64_t t0){
+    TraceBuffer *b = trace_tls;
+    if(!b) return;
+
+    uint64_t t1 = now_ns();
+    size_t n = atomic_load_explicit(&b->count, memory_order_relaxed);
+    size_t chunk = n / TRACE_CHUNK;
+    if(n % TRACE_CHUNK == 0 && (chunk == TRACE_MAX_CHUNKS
+                                || !(b->chunks[chunk] = malloc(TRACE_CHUNK * sizeof(TraceSpan))))){
+        atomic_fetch_add_explicit(&b->lost, 1, memory_order_relaxed);
+        return;
+    }
+
+    TraceSpan *sp = &b->chunks[chunk][n % TRACE_CHUNK];
+    sp->begin_ns = t0;
+    sp->dur_ns = t1 - t0 < UINT32_MAX ? (uint32_t)(t1 - t0) : UINT32_MAX;
+    sp->kind = kind;
+    atomic_store_explicit(&b->count, n + 1, memory_order_release);
+}
+
+/**
+ * Grava em trace.path todos os trechos publicados até agora, como um
+ * objeto JSON {"traceEvents": [...]} com eventos completos ("X") em
+ * microssegundos. O arquivo é escrito ao lado e renomeado, então quem
+ * o abre nunca vê um trace pela metade.
+ */
+void trace_dump(void){
+    if(!trace.path) return;
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", trace.path);
+    FILE *fp = fopen(tmp, "w");
+    if(!fp){
+        fprintf(stderr, "supernova: não foi possível criar '%s': %s\n", tmp, strerror(errno));
+        return;
+    }
+
+    pthread_mutex_lock(&trace.lock);
+    int nthreads = trace.nthreads;
+    pthread_mutex_unlock(&trace.lock);
+
+    uint64_t lost = 0;
+    fprintf(fp, "{\"traceEvents\": [\n"
+                "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"supernova\"}}");
+    for(int t = 0; t < nthreads; t++){
+        TraceBuffer *b = trace.threads[t];
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                    "\"args\": {\"name\": \"%s\"}}", b->tid, b->name);
+
+        size_t n = atomic_load_explicit(&b->count, memory_order_acquire);
+        for(size_t i = 0; i < n; i++){
+            const TraceSpan *sp = &b->chunks[i / TRACE_CHUNK][i % TRACE_CHUNK];
+            fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"frame\", \"ph\": \"X\", \"ts\": %.3f, "
+                        "\"dur\": %.3f, \"pid\": 1, \"tid\": %d}",
+                    trace_names[sp->kind], (sp->begin_ns - trace.t0) / 1e3, sp->dur_ns / 1e3, b->tid);
+        }
+        lost += atomic_load_explicit(&b->lost, memory_order_relaxed);
+    }
+    fprintf(fp, "\n], \"displayTimeUnit\": \"ns\", \"otherData\": {\"lost_spans\": %llu}}\n",
+            (unsigned long long)lost);
+
+    if(ferror(fp) | (fclose(fp) != 0) || rename(tmp, trace.path) != 0){
+        fprintf(stderr, "supernova: erro ao gravar o trace: %s\n", strerror(errno));
+        unlink(tmp);
+    }
+}
+
+// Liga o trace: confere que o arquivo pode ser criado e registra a
+// thread principal
+void trace_open(const char *path){
+    FILE *fp = fopen(path, "w");
+    if(!fp){
+        fprintf(stderr, "supernova: não foi possível criar '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    fclose(fp);
+
+    trace.path = path;
+    trace.t0 = now_ns();
+    trace_thread("simulação");
+}
+
+typedef struct {
+    RenderPool *pool;
+    int id;
+} PoolWorker;
+
+static void *pool_thread(void *arg){
+    PoolWorker *w = arg;
+    RenderPool *pool = w->pool;
+    uint64_t seen = 0;
+
+    char name[32];
+    snprintf(name, sizeof(name), "render %d", w->id);
+    trace_thread(name);
+
+    pthread_mutex_lock(&pool->lock);
+    for(;;){
+        while(pool->generation == seen && !pool->shutdown)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if(pool->shutdown) break;
+        seen = pool->generation;
+
+        PoolJob job = pool->job;
+        void *ctx = pool->ctx;
+        pthread_mutex_unlock(&pool->lock);
+
+        job(ctx, w->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(w);
+    return NULL;
+}
+
+void pool_init(RenderPool *pool, int nthreads){
+    memset(pool, 0, sizeof(*pool));
+    pool->nthreads = nthreads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    if(nthreads < 2) return;
+
+    pool->threads = malloc((size_t)nthreads * sizeof(pthread_t));
+    pool->ntouched = malloc((size_t)nthreads * nthreads * sizeof(int));
+    if(!pool->threads || !pool->ntouched){
+        fprintf(stderr, "supernova: sem memória para %d threads\n", nthreads);
+        exit(1);
+    }
+    for(int i = 1; i < nthreads; i++){
+        PoolWorker *w = malloc(sizeof(*w));
+        if(w){
+            w->pool = pool;
+            w->id = i;
+        }
+        if(!w || pthread_create(&pool->threads[i], NULL, pool_thread, w) != 0){
+            fprintf(stderr, "supernova: não foi possível criar a thread %d\n", i);
+            exit(1);
+        }
+    }
+}
+
+void pool_destroy(RenderPool *pool){
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 1; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    free(pool->threads);
+    free(pool->hits);
+    free(pool->counts);
+    free(pool->touched);
+    free(pool->ntouched);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+}
+
+/**
+ * Executa job(ctx, i) em todos os trabalhadores e retorna quando todos
+ * terminarem. A thread chamadora executa a parte do trabalhador 0.
+ */
+void pool_run(RenderPool *pool, PoolJob job, void *ctx){
+    if(pool->nthreads > 1){
+        pthread_mutex_lock(&pool->lock);
+        pool->job = job;
+        pool->ctx = ctx;
+        pool->pending = pool->nthreads - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    job(ctx, 0);
+
+    if(pool->nthreads > 1){
+        pthread_mutex_lock(&pool->lock);
+        while(pool->pending > 0)
+            pthread_cond_wait(&pool->done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// Garante um mapa de acertos zerado de ncells por trabalhador (só cresce)
+void pool_reserve_hits(RenderPool *pool, size_t ncells){
+    if(ncells <= pool->hits_cap) return;
+
+    size_t cap = ncells + ncells / 2;
+    pool->hits_stride = (cap + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    free(pool->hits);
+    pool->hits = alloc_aligned(pool->hits_stride * pool->nthreads);
+    memset(pool->hits, 0, pool->hits_stride * pool->nthreads);
+    pool->hits_cap = cap;
+}
+
+// Garante um mapa zerado de n contadores de densidade por trabalhador (só cresce)
+void pool_reserve_counts(RenderPool *pool, size_t n){
+    if(n <= pool->counts_cap) return;
+
+    const size_t line = CACHE_LINE / sizeof(uint32_t);
+    size_t cap = n + n / 2;
+    pool->counts_stride = (cap + line - 1) & ~(line - 1);
+    free(pool->counts);
+    pool->counts = alloc_aligned(pool->counts_stride * pool->nthreads * sizeof(uint32_t));
+    memset(pool->counts, 0, pool->counts_stride * pool->nthreads * sizeof(uint32_t));
+    pool->counts_cap = cap;
+}
+
+// Garante uma lista de ncells células marcadas por trabalhador (só cresce)
+void pool_reserve_touched(RenderPool *pool, size_t ncells){
+    if(ncells <= pool->touched_cap) return;
+
+    const size_t line = CACHE_LINE / sizeof(uint32_t);
+    size_t cap = ncells + ncells / 2;
+    pool->touched_stride = (cap + line - 1) & ~(line - 1);
+    free(pool->touched);
+    pool->touched = alloc_aligned(pool->touched_stride * pool->nthreads * sizeof(uint32_t));
+    pool->touched_cap = cap;
+}
+
+// Parte [lo, hi) do i-ésimo de n pedaços de [0, total)
+static inline void split_range(int total, int i, int n, int *lo, int *hi){
+    *lo = (int)((int64_t)total * i / n);
+    *hi = (int)((int64_t)total * (i + 1) / n);
+}
+
+/**
+ * Lançamento de uma partícula a partir do seu número r = rng_at(key, i),
+ * com key = RNG_SPAWN do ciclo. Os 64 bits fornecem ângulo (24 bits),
+ * duração (24 bits) e velocidade (16 bits). Como dependem só de (key, i),
+ * podem ser refeitos a qualquer momento (ver --procedural); a vida vem
+ * separada para que partículas mortas não paguem o seno e o cosseno.
+ */
+static inline float launch_life(uint64_t r){
+    return 2.5 + rng_unit(r >> 24)*1.5;
+}
+
+static inline void launch_velocity(uint64_t r, float *vx, float *vy){
+    float angle = rng_unit(r) * 2*M_PI;
+    float speed = 10 + (r >> 48) % 40; // velocidades variadas → explosão irregular
+
+    *vx = cos(angle) * speed;
+    *vy = sin(angle) * speed * 0.55;
+}
+
+/**
+ * Geração das partículas ejetadas pela explosão.
+ * Representam o "ejecta" rico em elementos pesados.
+ */
+void spawn_particles(Star *s){
+    Particles *p = &s->particles;
+    uint64_t key = rng_key(s->seed, RNG_SPAWN(s->cycle));
+    p->count = p->capacity;
+
+    for(int i=0;i<p->count;i++){
+        uint64_t r = rng_at(key, i);
+        p->x[i] = 0;
+        p->y[i] = 0;
+        launch_velocity(r, &p->vx[i], &p->vy[i]);
+        p->life[i] = launch_life(r);
+    }
+}
+
+/**
+ * Escreve todo o buffer em fd, repetindo apenas em escrita parcial
+ * ou interrupção por sinal. Em regime normal é uma única syscall.
+ */
+int write_all(int fd, const char *buf, size_t len){
+    int calls = 0;
+    while(len > 0){
+        ssize_t n = write(fd, buf, len);
+        calls++;
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return calls;
+}
+
+/**
+ * Intervalo [*lo, *hi) das células da linha y cuja distância ao centro
+ * é <= r (ou < r, se strict). Como o disco é convexo, o conjunto em cada
+ * linha é sempre contíguo. As bordas vêm da equação do círculo e são
+ * então ajustadas contra a tabela polar, para que o resultado seja
+ * exatamente o do teste célula a célula; o ajuste custa O(1) por linha.
+ */
+static void row_span(const Geometry *g, int y, float r, int strict, int *lo, int *hi){
+    const int width = g->width;
+    const float *radius = g->radius + (size_t)y * width;
+    float dy = (y - g->cy) * g->aspect;
+    float R = r * g->scale;
+    float h2 = R*R - dy*dy;
+    int a, b;
+
+    // r = 0 ainda contém a célula do centro, se ela estiver em d = 0
+    if(r < 0 || (strict && r == 0)){
+        *lo = *hi = 0;
+        return;
+    }
+
+    if(h2 >= 0){
+        float hw = sqrtf(h2);
+        a = (int)ceilf(g->cx - hw);
+        b = (int)floorf(g->cx + hw) + 1;
+    } else {
+        a = b = (int)ceilf(g->cx);
+    }
+    if(a < 0) a = 0;
+    if(b > width) b = width;
+    if(a > width) a = width;
+    if(b < a) b = a;
+
+#define INSIDE(i) (strict ? radius[i] < r : radius[i] <= r)
+    while(a < b && !INSIDE(a)) a++;
+    while(b > a && !INSIDE(b - 1)) b--;
+    while(a > 0 && INSIDE(a - 1)) a--;
+    while(b < width && INSIDE(b)) b++;
+#undef INSIDE
+
+    *lo = a;
+    *hi = b;
+}
+
+// Preenche o disco d <= r na linha y
+static void fill_disk(const Geometry *g, char *row, int y, float r, char c){
+    int lo, hi;
+    row_span(g, y, r, 0, &lo, &hi);
+    if(hi > lo) memset(row + lo, c, (size_t)(hi - lo));
+}
+
+/**
+ * Preenche o anel r_in <= d <= r_out na linha y: o intervalo do disco
+ * externo menos o do disco interno aberto (d < r_in), até dois trechos.
+ */
+static void fill_ring(const Geometry *g, char *row, int y, float r_in, float r_out, char c){
+    int a, b, c0, c1;
+    row_span(g, y, r_out, 0, &a, &b);
+    if(b <= a) return;
+
+    row_span(g, y, r_in, 1, &c0, &c1);
+    if(c1 <= c0){
+        memset(row + a, c, (size_t)(b - a));
+        return;
+    }
+    if(c0 > a) memset(row + a, c, (size_t)(c0 - a));
+    if(b > c1) memset(row + c1, c, (size_t)(b - c1));
+}
+
+/**
+ * Núcleos de renderização especializados por fase.
+ * Cada um desenha as camadas contínuas das linhas [y0, y1) sem testar o
+ * estado: a fase é constante no frame, então draw_star escolhe o núcleo
+ * uma única vez e os laços internos ficam livres de desvios de estado.
+ * O núcleo compacto ('O') é comum a todas as fases; seu raio é zero até
+ * o primeiro bounce.
+ */
+typedef void (*RenderKernel)(const Star *s, const Geometry *g, char *cells, int y0, int y1);
+
+// Supergigante massiva pulsando
+static void render_giant(const Star *s, const Geometry *g, char *cells, int y0, int y1){
+    for(int y = y0; y < y1; y++){
+        char *row = cells + (size_t)y * g->width;
+        memset(row, ' ', g->width);
+        fill_disk(g, row, y, s->radius, '#');
+        fill_disk(g, row, y, s->core_radius, 'O');
+    }
+}
+
+// Contração do núcleo e esmagamento gravitacional
+static void render_collapse(const Star *s, const Geometry *g, char *cells, int y0, int y1){
+    for(int y = y0; y < y1; y++){
+        char *row = cells + (size_t)y * g->width;
+        memset(row, ' ', g->width);
+        fill_disk(g, row, y, s->radius, '@');
+        fill_disk(g, row, y, s->core_radius, 'O');
+    }
+}
+
+// Frente de choque inicial
+static void render_bounce(const Star *s, const Geometry *g, char *cells, int y0, int y1){
+    for(int y = y0; y < y1; y++){
+        char *row = cells + (size_t)y * g->width;
+        memset(row, ' ', g->width);
+        fill_ring(g, row, y, s->radius - 1.5f, s->radius, '*');
+        fill_disk(g, row, y, s->core_radius, 'O');
+    }
+}
+
+// Onda de choque se expandindo rapidamente
+static void render_explosion(const Star *s, const Geometry *g, char *cells, int y0, int y1){
+    for(int y = y0; y < y1; y++){
+        char *row = cells + (size_t)y * g->width;
+        memset(row, ' ', g->width);
+        fill_ring(g, row, y, s->explosion_radius - 1.6f, s->explosion_radius, '*');
+        fill_disk(g, row, y, s->core_radius, 'O');
+    }
+}
+
+// Remanescente difuso da supernova
+static void render_nebula(const Star *s, const Geometry *g, char *cells, int y0, int y1){
+    const uint64_t noise = rng_key(s->seed, RNG_NOISE(s->tick));
+    const unsigned sub = g->subpixels;
+
+    for(int y = y0; y < y1; y++){
+        char *row = cells + (size_t)y * g->width;
+        uint64_t base = (uint64_t)y * g->width;
+        int lo, hi;
+
+        memset(row, ' ', g->width);
+        row_span(g, y, s->explosion_radius, 0, &lo, &hi);
+        // Um ponto a cada 12 células em média em qualquer conjunto de
+        // glifos: r % (12 * sub) == 0, com o segundo teste (e a divisão
+        // por um valor não constante) só em 1/12 das células
+        for(int x = lo; x < hi; x++){
+            uint64_t r = rng_at(noise, base + x);
+            if(r % 12 == 0 && (sub == 1 || (r / 12) % sub == 0))
+                row[x] = '.';
+        }
+        fill_disk(g, row, y, s->core_radius, 'O');
+    }
+}
+
+static const RenderKernel render_kernels[] = {
+    [GIANT]     = render_giant,
+    [COLLAPSE]  = render_collapse,
+    [BOUNCE]    = render_bounce,
+    [EXPLOSION] = render_explosion,
+    [NEBULA]    = render_nebula,
+};
+
+// Célula onde cai a partícula (x, y), ou -1 se estiver fora da grade
+static inline int particle_cell(const Geometry *g, float x, float y){
+    int px = (int)(g->cx + x * g->scale);
+    int py = (int)(g->cy + y * g->yscale);
+
+    if(px < 0 || px >= g->width || py < 0 || py >= g->height) return -1;
+    return py * g->width + px;
+}
+
+/**
+ * Célula da partícula i, ou -1 se estiver fora da grade ou morta.
+ * Em *life fica a vida restante, usada para a cor.
+ */
+static inline int ejecta_cell(const Star *s, const Geometry *g, int i, float *life){
+    const Particles *p = &s->particles;
+    if(!s->analytic){
+        *life = p->life[i];
+        return particle_cell(g, p->x[i], p->y[i]);
+    }
+
+    // Procedural: o lançamento é refeito a partir da semente
+    if(s->procedural){
+        uint64_t r = rng_at(s->spawn_key, i);
+        float vx, vy;
+        *life = launch_life(r) - s->age;
+        if(*life <= 0) return -1;
+        launch_velocity(r, &vx, &vy);
+        return particle_cell(g, vx * s->age, vy * s->age);
+    }
+
+    // Forma fechada: posição e vida avaliadas a partir do lançamento
+    *life = p->life[i] - s->age;
+    if(*life <= 0) return -1;
+    return particle_cell(g, p->vx[i] * s->age, p->vy[i] * s->age);
+}
+
+// Cor da temperatura t em [0, 1] na rampa HEAT
+static inline uint8_t heat_color(float t){
+    return HEAT_BASE + (int)(clamp(t, 0, 1) * (HEAT_LEVELS - 1) + 0.5f);
+}
+
+// Ejecta esfria com a vida restante: de laranja a vermelho escuro
+static inline uint8_t ejecta_color(float life){
+    return heat_color(0.1f + 0.45f * life / 4.0f);
+}
+
+/**
+ * Cores das camadas contínuas nas linhas [y0, y1), a partir do glifo,
+ * da fase e da distância ao centro (tabela polar): envelope alaranjado
+ * mais frio na borda, colapso esquentando ao contrair, choque branco-
+ * azulado que esfria ao se expandir e nebulosa que se apaga.
+ */
+static void colorize_rows(const Star *s, const Geometry *g, Frame *f, int y0, int y1){
+    const uint8_t core = heat_color(1.0f);
+    const uint8_t collapse = heat_color(0.55f + 0.35f * clamp((9 - s->radius) / 6, 0, 1));
+    const uint8_t bounce = heat_color(0.95f);
+    const float cooling = clamp((s->explosion_radius - 3) / 29, 0, 1);
+    const float fade = clamp((s->explosion_radius - 32) / 10, 0, 1);
+
+    for(int y = y0; y < y1; y++){
+        size_t row = (size_t)y * g->width;
+        for(int x = 0; x < g->width; x++){
+            size_t i = row + x;
+            float r = g->radius[i];
+            uint8_t c;
+
+            switch(f->cells[i]){
+                case 'O': c = core; break;
+                case '#': c = heat_color(0.40f - 0.25f * r / s->radius); break;
+                case '@': c = collapse; break;
+                case '*':
+                    if(s->state == BOUNCE) c = bounce;
+                    else c = heat_color(1.0f - 0.35f * cooling
+                                        - 0.25f * clamp((s->explosion_radius - r) / 1.6f, 0, 1));
+                    break;
+                case '.':
+                    c = NEBULA_BASE + (int)((NEBULA_LEVELS - 1)
+                                            * clamp(0.6f * fade + 0.4f * r / s->explosion_radius, 0, 1));
+                    break;
+                default: c = COLOR_DEFAULT;
+            }
+            f->colors[i] = c;
+        }
+    }
+}
+
+/**
+ * Posição (relativa ao centro) e vida restante das partículas
+ * [i0, i0+n) em *x, *y e *life. O modo de evolução é decidido uma vez
+ * por bloco, e não por partícula como em ejecta_cell: no integrador os
+ * ponteiros apontam direto para os vetores SoA; nos outros modos os
+ * valores são calculados em buf.
+ */
+static void ejecta_block(const Star *s, int i0, int n, float buf[3][DENSITY_BLOCK],
+                         const float **x, const float **y, const float **life){
+    const Particles *p = &s->particles;
+    const float age = s->age;
+
+    if(!s->analytic){
+        *x = p->x + i0;
+        *y = p->y + i0;
+        *life = p->life + i0;
+        return;
+    }
+
+    *x = buf[0];
+    *y = buf[1];
+    *life = buf[2];
+    if(s->procedural){
+        for(int k = 0; k < n; k++){
+            uint64_t r = rng_at(s->spawn_key, (uint64_t)i0 + k);
+            buf[2][k] = launch_life(r) - age;
+            buf[0][k] = buf[1][k] = 0;
+            if(buf[2][k] <= 0) continue;  // Mortas não pagam seno e cosseno
+            launch_velocity(r, &buf[0][k], &buf[1][k]);
+            buf[0][k] *= age;
+            buf[1][k] *= age;
+        }
+        return;
+    }
+    for(int k = 0; k < n; k++){
+        buf[0][k] = p->vx[i0 + k] * age;
+        buf[1][k] = p->vy[i0 + k] * age;
+        buf[2][k] = p->life[i0 + k] - age;
+    }
+}
+
+/**
+ * Célula e peso das n partículas a partir de b, sem desvios, para que
+ * o compilador vetorize. Partículas mortas ou fora da grade vão para a
+ * célula sentinela width*height. O peso é DENSITY_ONE ou, em
+ * DENSITY_LIFE, proporcional à vida restante. Retorna quantas dessas
+ * partículas estão vivas.
+ */
+static int density_block(const Star *s, const Geometry *g, int mode, int b, int n,
+                         uint32_t *cell, uint32_t *weight){
+    const int width = g->width, height = g->height;
+    const uint32_t sentinel = (uint32_t)width * height;
+    const float life_weight = (DENSITY_ONE - 1) / 4.0f;  // Vida máxima de lançamento: 4 s
+    float buf[3][DENSITY_BLOCK];
+    const float *x, *y, *life;
+    int live = 0;
+
+    ejecta_block(s, b, n, buf, &x, &y, &life);
+    for(int k = 0; k < n; k++){
+        int px = (int)(g->cx + x[k] * g->scale);
+        int py = (int)(g->cy + y[k] * g->yscale);
+        float l = life[k] > 0 ? life[k] : 0;
+        int in = ((unsigned)px < (unsigned)width) & ((unsigned)py < (unsigned)height) & (life[k] > 0);
+        cell[k] = in ? (uint32_t)py * width + px : sentinel;
+        weight[k] = mode == DENSITY_LIFE ? 1 + (uint32_t)(l * life_weight) : DENSITY_ONE;
+        live += life[k] > 0;
+    }
+    return live;
+}
+
+/**
+ * Acumula as partículas [i0, i1) nos contadores counts (width*height,
+ * mais a sentinela): cada bloco passa por density_block e depois pelo
+ * espalhamento, um incremento saturado por partícula. Retorna quantas
+ * dessas partículas estão vivas.
+ */
+static int accumulate_density(const Star *s, const Geometry *g, int mode, int i0, int i1, uint32_t *counts){
+    uint32_t cell[DENSITY_BLOCK], weight[DENSITY_BLOCK];
+    int live = 0;
+
+    for(int b = i0; b < i1; b += DENSITY_BLOCK){
+        const int n = i1 - b < DENSITY_BLOCK ? i1 - b : DENSITY_BLOCK;
+        live += density_block(s, g, mode, b, n, cell, weight);
+        for(int k = 0; k < n; k++){
+            uint32_t v = counts[cell[k]] + weight[k];
+            counts[cell[k]] = v < DENSITY_MAX ? v : DENSITY_MAX;
+        }
+    }
+    return live;
+}
+
+// Degrau da rampa de um contador não nulo: 1 partícula é '.', e cada
+// dobro sobe um degrau até '@'
+static inline int density_level(uint32_t v){
+    int l = 1;
+    for(v /= DENSITY_ONE; v > 1 && l < DENSITY_LEVELS; v >>= 1) l++;
+    return l;
+}
+
+// Desenha a célula c, com contador v não nulo, pela rampa de intensidade.
+// Com cores, regiões mais densas são mais quentes.
+static inline void shade_cell(Frame *f, size_t c, uint32_t v){
+    int l = density_level(v);
+    f->cells[c] = density_ramp[l];
+    if(f->colors) f->colors[c] = heat_color(0.1f + 0.45f * l / DENSITY_LEVELS);
+}
+
+// Desenha as células [c0, c1) com partículas, por cima das camadas
+static void shade_density(const uint32_t *counts, Frame *f, size_t c0, size_t c1){
+    for(size_t c = c0; c < c1; c++)
+        if(counts[c]) shade_cell(f, c, counts[c]);
+}
+
+// Contexto de um frame renderizado pelo pool
+typedef struct {
+    const Star *s;
+    const Geometry *g;
+    Frame *f;
+    RenderPool *pool;
+    int live[MAX_THREADS];       // Partículas vivas na fatia de cada trabalhador
+    size_t first[MAX_THREADS];   // Primeira célula de cada faixa
+    uint8_t band[MAX_DIM];       // Faixa de cada linha
+} DrawJob;
+
+// Lista das células marcadas pelo trabalhador worker na faixa band
+static inline uint32_t *touched_list(const DrawJob *job, int worker, int band){
+    return job->pool->touched + job->pool->touched_stride * worker + job->first[band];
+}
+
+/**
+ * Etapa 1: camadas contínuas da faixa de linhas do trabalhador e
+ * marcação da sua fatia de partículas no seu mapa de acertos privado.
+ * Cada célula marcada pela primeira vez entra na lista da sua faixa.
+ */
+static void draw_layers_job(void *ctx, int worker){
+    DrawJob *job = ctx;
+    const Particles *p = &job->s->particles;
+    const int n = job->pool->nthreads, width = job->f->width, height = job->f->height;
+    uint32_t *touched = job->pool->touched + job->pool->touched_stride * worker;
+    int *ntouched = job->pool->ntouched + n * worker;
+    uint64_t span = trace_begin();
+    int y0, y1, i0, i1;
+
+    split_range(height, worker, n, &y0, &y1);
+    render_kernels[job->s->state](job->s, job->g, job->f->cells, y0, y1);
+    if(job->f->colors) colorize_rows(job->s, job->g, job->f, y0, y1);
+
+    memset(ntouched, 0, n * sizeof(*ntouched));
+    job->live[worker] = 0;
+    if(p->count == 0){
+        trace_end(TRACE_LAYERS, span);
+        return;
+    }
+
+    split_range(p->count, worker, n, &i0, &i1);
+    int live = 0;
+    if(job->pool->density){
+        const uint32_t sentinel = (uint32_t)width * height;
+        uint32_t *counts = job->pool->counts + job->pool->counts_stride * worker;
+        uint32_t cell[DENSITY_BLOCK], weight[DENSITY_BLOCK];
+
+        for(int b = i0; b < i1; b += DENSITY_BLOCK){
+            const int m = i1 - b < DENSITY_BLOCK ? i1 - b : DENSITY_BLOCK;
+            live += density_block(job->s, job->g, job->pool->density, b, m, cell, weight);
+            for(int k = 0; k < m; k++){
+                uint32_t c = cell[k], old = counts[c], v = old + weight[k];
+                counts[c] = v < DENSITY_MAX ? v : DENSITY_MAX;
+                if(!old && c != sentinel){
+                    int band = job->band[c / width];
+                    touched[job->first[band] + ntouched[band]++] = c;
+                }
+            }
+        }
+        counts[sentinel] = 0;
+    } else {
+        // Com cores, o acerto guarda a cor da partícula mais quente
+        uint8_t *hits = job->pool->hits + job->pool->hits_stride * worker;
+        for(int i = i0; i < i1; i++){
+            float life;
+            int c = ejecta_cell(job->s, job->g, i, &life);
+            live += life > 0;
+            if(c < 0) continue;
+            uint8_t h = job->f->colors ? ejecta_color(life) : 1;
+            if(!hits[c]){
+                int band = job->band[c / width];
+                touched[job->first[band] + ntouched[band]++] = (uint32_t)c;
+            }
+            if(h > hits[c]) hits[c] = h;
+        }
+    }
+    job->live[worker] = live;
+    trace_end(TRACE_LAYERS, span);
+}
+
+/**
+ * Etapa 2: cada trabalhador percorre as listas de todos para a sua
+ * faixa, combina os acertos, desenha as partículas por cima das
+ * camadas e zera as células lidas nos mapas.
+ */
+static void draw_particles_job(void *ctx, int worker){
+    DrawJob *job = ctx;
+    RenderPool *pool = job->pool;
+    const int n = pool->nthreads;
+    uint64_t span = trace_begin();
+
+    // Densidade: os contadores de todos são somados nos do trabalhador
+    // 0, e cada célula é desenhada uma vez
+    if(pool->density){
+        uint32_t *sum = pool->counts;
+        for(int t = 1; t < n; t++){
+            uint32_t *part = pool->counts + pool->counts_stride * t;
+            const uint32_t *list = touched_list(job, t, worker);
+            for(int j = 0; j < pool->ntouched[n * t + worker]; j++){
+                uint32_t c = list[j];
+                uint32_t v = sum[c] + part[c];
+                sum[c] = v < DENSITY_MAX ? v : DENSITY_MAX;
+                part[c] = 0;
+            }
+        }
+        for(int t = 0; t < n; t++){
+            const uint32_t *list = touched_list(job, t, worker);
+            for(int j = 0; j < pool->ntouched[n * t + worker]; j++){
+                uint32_t c = list[j];
+                if(!sum[c]) continue;
+                shade_cell(job->f, c, sum[c]);
+                sum[c] = 0;
+            }
+        }
+        trace_end(TRACE_SPLAT, span);
+        return;
+    }
+
+    char *cells = job->f->cells;
+    uint8_t *colors = job->f->colors;
+    for(int t = 0; t < n; t++){
+        uint8_t *hits = pool->hits + pool->hits_stride * t;
+        const uint32_t *list = touched_list(job, t, worker);
+        for(int j = 0; j < pool->ntouched[n * t + worker]; j++){
+            uint32_t c = list[j];
+            uint8_t h = hits[c];
+            hits[c] = 0;
+            if(colors && (cells[c] != '+' || h > colors[c])) colors[c] = h;
+            cells[c] = '+';
+        }
+    }
+    trace_end(TRACE_SPLAT, span);
+}
+
+/**
+ * Renderização da estrela e fenômenos associados
+ * Cada símbolo representa um estado físico aproximado:
+ * #  = envelope estelar estável
+ * @  = estrela colapsando
+ * *  = choque sendo propagado
+ * +  = partículas de ejecta
+ * .  = gás difuso (nebulosa)
+ * O  = estrela de nêutrons remanescente
+ *
+ * A imagem é composta em duas passadas sobre um frame buffer:
+ * primeiro as camadas contínuas (envelope, choque, nebulosa e núcleo),
+ * depois cada partícula (todas vivas, ver Particles) é rasterizada
+ * uma única vez por cima. O custo fica O(N + W*H) em vez de O(N * W*H).
+ *
+ * As camadas contínuas são círculos e anéis em torno do centro: cada
+ * linha calcula analiticamente seus trechos internos e preenche apenas
+ * esses trechos, então o custo acompanha as células cobertas.
+ *
+ * Com --density, as partículas são somadas em contadores por célula e
+ * o glifo sai da rampa de intensidade (ver accumulate_density).
+ *
+ * Com mais de uma thread (--threads), o frame é dividido em faixas de
+ * linhas renderizadas pelo pool (ver RenderPool).
+ *
+ * Retorna o número de partículas vivas, contado de passagem.
+ */
+int draw_star(Star *s, const Geometry *g, Frame *f, RenderPool *pool){
+    const size_t ncells = (size_t)f->width * f->height;
+    f->state = s->state;
+    if(pool->density) pool_reserve_counts(pool, ncells + 1);
+
+    if(pool->nthreads > 1){
+        DrawJob job;
+        int live = 0, y0, y1;
+        job.s = s;
+        job.g = g;
+        job.f = f;
+        job.pool = pool;
+        for(int b = 0; b < pool->nthreads; b++){
+            split_range(f->height, b, pool->nthreads, &y0, &y1);
+            job.first[b] = (size_t)y0 * f->width;
+            memset(job.band + y0, b, y1 - y0);
+        }
+        if(!pool->density) pool_reserve_hits(pool, ncells);
+        pool_reserve_touched(pool, ncells);
+        pool_run(pool, draw_layers_job, &job);
+        if(s->particles.count > 0) pool_run(pool, draw_particles_job, &job);
+        for(int t = 0; t < pool->nthreads; t++) live += job.live[t];
+        return live;
+    }
+
+    // Em uma única thread, as mesmas etapas do pool aparecem no trace
+    uint64_t span = trace_begin();
+    render_kernels[s->state](s, g, f->cells, 0, f->height);
+    if(f->colors) colorize_rows(s, g, f, 0, f->height);
+    trace_end(TRACE_LAYERS, span);
+
+    const Particles *p = &s->particles;
+    if(p->count == 0) return 0;
+    span = trace_begin();
+    if(pool->density){
+        memset(pool->counts, 0, (ncells + 1) * sizeof(*pool->counts));
+        int live = accumulate_density(s, g, pool->density, 0, p->count, pool->counts);
+        shade_density(pool->counts, f, 0, ncells);
+        trace_end(TRACE_SPLAT, span);
+        return live;
+    }
+
+    // Partículas de ejecta — sobrepõem todas as outras camadas; com
+    // cores, vale a da partícula mais quente da célula
+    int live = 0;
+    for(int i=0;i<p->count;i++){
+        float life;
+        int c = ejecta_cell(s, g, i, &life);
+        live += life > 0;
+        if(c < 0) continue;
+        if(f->colors){
+            uint8_t k = ejecta_color(life);
+            if(f->cells[c] != '+' || k > f->colors[c]) f->colors[c] = k;
+        }
+        f->cells[c] = '+';
+    }
+    trace_end(TRACE_SPLAT, span);
+    return live;
+}
+
+/**
+ * Compacta a tela de subpixels em f (--charset): cada célula recebe a
+ * máscara dos seus subpixels acesos (não brancos) e, com cores, a cor
+ * mais quente entre eles (Palette::rank). Uma passada linear, linha de subpixels a
+ * linha de subpixels, com os bits vindos de uma tabela por posição.
+ */
+void pack_cells(const Frame *canvas, Frame *f){
+    const Glyphs *gl = f->glyphs;
+    const int sx = gl->sx, sy = gl->sy;
+    const uint8_t *rank = f->palette ? f->palette->rank : NULL;
+    uint8_t bits[4][2];
+
+    for(int dy = 0; dy < sy; dy++)
+        for(int dx = 0; dx < sx; dx++)
+            bits[dy][dx] = gl->charset == CHARSET_BRAILLE ? braille_bit[dy][dx] : (uint8_t)(1 << dy);
+
+    f->state = canvas->state;
+    for(int y = 0; y < f->height; y++){
+        uint8_t *mask = (uint8_t *)f->cells + (size_t)y * f->width;
+        uint8_t *color = f->colors ? f->colors + (size_t)y * f->width : NULL;
+        memset(mask, 0, f->width);
+        if(color) memset(color, COLOR_DEFAULT, f->width);
+
+        for(int dy = 0; dy < sy; dy++){
+            size_t row = (size_t)(y * sy + dy) * canvas->width;
+            const char *src = canvas->cells + row;
+            for(int x = 0; x < f->width; x++){
+                for(int dx = 0; dx < sx; dx++){
+                    int lit = src[x * sx + dx] != ' ';
+                    mask[x] |= lit ? bits[dy][dx] : 0;
+                    if(color && lit){
+                        uint8_t c = canvas->colors[row + x * sx + dx];
+                        if(rank[c] > rank[color[x]]) color[x] = c;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Renderiza o frame f, passando pela tela de subpixels se houver
+// glifos; retorna o número de partículas vivas
+int render_frame(Star *s, const Geometry *g, Frame *canvas, Frame *f, RenderPool *pool){
+    uint64_t span = trace_begin();
+    int live;
+
+    if(f->glyphs){
+        live = draw_star(s, g, canvas, pool);
+        pack_cells(canvas, f);
+    } else {
+        live = draw_star(s, g, f, pool);
+    }
+    trace_end(TRACE_RENDER, span);
+    return live;
+}
+
+/**
+ * Renderizador de referência: o teste célula a célula, com a cadeia de
+ * estados avaliada em cada célula, como antes dos núcleos especializados.
+ * Usado apenas pelo --bench, para medir o ganho dos núcleos e conferir
+ * que ambos produzem a mesma imagem (camadas contínuas, sem partículas).
+ */
+void draw_star_reference(const Star *s, const Geometry *g, char *cells){
+    const int width = g->width, height = g->height;
+    const uint64_t noise = rng_key(s->seed, RNG_NOISE(s->tick));
+
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            float d = g->radius[(size_t)y * width + x];
+            char pixel = ' ';
+
+            if(s->state == GIANT){
+                if(d <= s->radius) pixel = '#';
+            }
+            else if(s->state == COLLAPSE){
+                if(d <= s->radius) pixel = '@';
+            }
+            else if(s->state == BOUNCE){
+                if(d <= s->radius && d >= s->radius - 1.5f) pixel = '*';
+            }
+            else if(s->state == EXPLOSION){
+                if(d <= s->explosion_radius && d >= s->explosion_radius - 1.6f)
+                    pixel = '*';
+            }
+            else if(s->state == NEBULA){
+                if(d <= s->explosion_radius && rng_at(noise, (uint64_t)y * width + x) % (12u * g->subpixels) == 0)
+                    pixel = '.';
+            }
+
+            if(d <= s->core_radius)
+                pixel = 'O';
+
+            cells[(size_t)y * width + x] = pixel;
+        }
+    }
+}
+
+// Pontos de controle das rampas da paleta (RGB), interpolados linearmente
+static const uint8_t heat_keys[][3] = {
+    {  90,  10,   0 },   // vermelho escuro
+    { 200,  35,   0 },   // vermelho
+    { 255, 120,   0 },   // laranja
+    { 255, 200,  60 },   // amarelo
+    { 255, 250, 225 },   // branco
+    { 170, 205, 255 },   // branco-azulado
+};
+static const uint8_t nebula_keys[][3] = {
+    { 255, 120, 190 },   // rosa
+    { 160,  70, 210 },   // púrpura
+    {  60,  25,  90 },   // púrpura escuro
+};
+
+// As 16 cores ANSI na paleta padrão do xterm (o preto fica de fora)
+static const uint8_t ansi16[16][3] = {
+    {   0,   0,   0 }, { 205,   0,   0 }, {   0, 205,   0 }, { 205, 205,   0 },
+    {   0,   0, 238 }, { 205,   0, 205 }, {   0, 205, 205 }, { 229, 229, 229 },
+    { 127, 127, 127 }, { 255,   0,   0 }, {   0, 255,   0 }, { 255, 255,   0 },
+    {  92,  92, 255 }, { 255,   0, 255 }, {   0, 255, 255 }, { 255, 255, 255 },
+};
+
+static void ramp(const uint8_t (*keys)[3], int nkeys, int levels, uint8_t (*out)[3]){
+    for(int i = 0; i < levels; i++){
+        float t = (float)i / (levels - 1) * (nkeys - 1);
+        int k = t < nkeys - 1 ? (int)t : nkeys - 2;
+        float u = t - k;
+        for(int c = 0; c < 3; c++)
+            out[i][c] = (uint8_t)(keys[k][c] + (keys[k + 1][c] - keys[k][c]) * u + 0.5f);
+    }
+}
+
+static int rgb_dist(const uint8_t *a, int r, int g, int b){
+    return (a[0] - r) * (a[0] - r) + (a[1] - g) * (a[1] - g) + (a[2] - b) * (a[2] - b);
+}
+
+// Cor mais próxima do cubo 6x6x6 ou da rampa de cinzas do modo 256
+static int nearest_256(const uint8_t *c){
+    static const int cube[6] = { 0, 95, 135, 175, 215, 255 };
+    int idx[3];
+    for(int i = 0; i < 3; i++)
+        idx[i] = c[i] < 48 ? 0 : c[i] < 115 ? 1 : (c[i] - 35) / 40;
+
+    int best = 16 + 36 * idx[0] + 6 * idx[1] + idx[2];
+    int dist = rgb_dist(c, cube[idx[0]], cube[idx[1]], cube[idx[2]]);
+
+    int avg = (c[0] + c[1] + c[2]) / 3;
+    int gray = avg < 8 ? 0 : avg > 238 ? 23 : (avg - 8) / 10;
+    int v = 8 + 10 * gray;
+    if(rgb_dist(c, v, v, v) < dist) best = 232 + gray;
+    return best;
+}
+
+static int nearest_16(const uint8_t *c){
+    int best = 1, dist = INT_MAX;
+    for(int i = 1; i < 16; i++){
+        int d = rgb_dist(ansi16[i], c[0], c[1], c[2]);
+        if(d < dist){
+            dist = d;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ * Monta as rampas da paleta e a sequência SGR de cada cor no nível
+ * pedido: RGB direto, o índice mais próximo do modo 256 ou a cor ANSI
+ * mais próxima. COLOR_DEFAULT volta à cor padrão do terminal.
+ */
+void palette_init(Palette *p, int level){
+    uint8_t rgb[COLOR_COUNT][3] = {{0}};
+    ramp(heat_keys, sizeof(heat_keys) / sizeof(heat_keys[0]), HEAT_LEVELS, rgb + HEAT_BASE);
+    ramp(nebula_keys, sizeof(nebula_keys) / sizeof(nebula_keys[0]), NEBULA_LEVELS, rgb + NEBULA_BASE);
+
+    p->level = level;
+    p->rank[COLOR_DEFAULT] = 0;
+    for(int k = 0; k < NEBULA_LEVELS; k++) p->rank[NEBULA_BASE + k] = (uint8_t)(NEBULA_LEVELS - k);
+    for(int k = 0; k < HEAT_LEVELS; k++) p->rank[HEAT_BASE + k] = (uint8_t)(NEBULA_LEVELS + 1 + k);
+
+    for(int i = 0; i < COLOR_COUNT; i++){
+        int n;
+        const uint8_t *c = rgb[i];
+        if(i == COLOR_DEFAULT) n = snprintf(p->code[i], sizeof(p->code[i]), "\033[39m");
+        else if(level == COLOR_TRUE) n = snprintf(p->code[i], sizeof(p->code[i]), "\033[38;2;%d;%d;%dm", c[0], c[1], c[2]);
+        else if(level == COLOR_256) n = snprintf(p->code[i], sizeof(p->code[i]), "\033[38;5;%dm", nearest_256(c));
+        else {
+            int k = nearest_16(c);
+            n = snprintf(p->code[i], sizeof(p->code[i]), "\033[%dm", k < 8 ? 30 + k : 90 + k - 8);
+        }
+        p->len[i] = (uint8_t)n;
+
+        p->canon[i] = (uint8_t)i;
+        for(int j = 0; j < i; j++){
+            if(p->len[j] == n && !memcmp(p->code[j], p->code[i], n)){
+                p->canon[i] = (uint8_t)j;
+                break;
+            }
+        }
+    }
+}
+
+// Meio bloco: bit 0 = metade de cima, bit 1 = metade de baixo
+static const unsigned half_glyph[4] = { ' ', 0x2580, 0x2584, 0x2588 };
+
+static int put_utf8(char *p, unsigned cp){
+    if(cp < 0x80){
+        p[0] = (char)cp;
+        return 1;
+    }
+    if(cp < 0x800){
+        p[0] = (char)(0xc0 | cp >> 6);
+        p[1] = (char)(0x80 | (cp & 0x3f));
+        return 2;
+    }
+    p[0] = (char)(0xe0 | cp >> 12);
+    p[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    p[2] = (char)(0x80 | (cp & 0x3f));
+    return 3;
+}
+
+/**
+ * Monta a tabela máscara → UTF-8. Braille: 2x4 subpixels, a máscara é
+ * o próprio deslocamento a partir de U+2800 (a máscara 0 vira espaço,
+ * para que o fundo seja igual ao do modo ASCII). Meio bloco: 1x2.
+ */
+void glyphs_init(Glyphs *gl, int charset){
+    memset(gl, 0, sizeof(*gl));
+    gl->charset = charset;
+    gl->sx = charset == CHARSET_BRAILLE ? 2 : 1;
+    gl->sy = charset == CHARSET_BRAILLE ? 4 : 2;
+
+    int masks = 1 << (gl->sx * gl->sy);
+    for(int m = 0; m < masks; m++){
+        unsigned cp = charset == CHARSET_BRAILLE ? (m ? 0x2800u + m : ' ') : half_glyph[m];
+        gl->len[m] = (uint8_t)put_utf8(gl->code[m], cp);
+    }
+}
+
+/**
+ * Escreve "\033[row;colH" (coordenadas 1-based) e retorna o avanço.
+ */
+int put_move(char *p, int row, int col){
+    char tmp[12];
+    int n = 0;
+
+    *p++ = '\033';
+    *p++ = '[';
+    do { tmp[n++] = '0' + row % 10; row /= 10; } while(row);
+    for(int i = 0; i < n; i++) p[i] = tmp[n - 1 - i];
+    p += n;
+    *p++ = ';';
+    int m = 0;
+    do { tmp[m++] = '0' + col % 10; col /= 10; } while(col);
+    for(int i = 0; i < m; i++) p[i] = tmp[m - 1 - i];
+    p += m;
+    *p = 'H';
+    return n + m + 4;
+}
+
+/**
+ * Copia n células a partir da célula i. Com paleta, um SGR precede a
+ * célula apenas quando a cor muda em relação à cor atual do terminal
+ * (f->pen), então uma sequência de células da mesma cor custa um único
+ * SGR; espaços não mostram cor e nunca trocam a cor atual. Com glifos,
+ * cada máscara sai como seu caractere UTF-8.
+ */
+static char *put_cells(Frame *f, char *p, size_t i, int n){
+    if(!f->palette && !f->glyphs){
+        memcpy(p, f->cells + i, (size_t)n);
+        return p + n;
+    }
+
+    const Palette *pal = f->palette;
+    const Glyphs *gl = f->glyphs;
+    const char blank = gl ? 0 : ' ';
+    for(size_t end = i + n; i < end; i++){
+        uint8_t ch = (uint8_t)f->cells[i];
+        if(pal && ch != blank && f->colors[i] != f->pen){
+            uint8_t c = f->colors[i];
+            memcpy(p, pal->code[c], pal->len[c]);
+            p += pal->len[c];
+            f->pen = c;
+        }
+        if(gl){
+            memcpy(p, gl->code[ch], 4);  // Copia fixa; só len bytes contam
+            p += gl->len[ch];
+        } else {
+            *p++ = (char)ch;
+        }
+    }
+    return p;
+}
+
+/**
+ * Repaint completo: cursor home + todas as linhas.
+ * O cursor apenas volta ao início: nada é apagado, então o terminal
+ * nunca exibe um frame parcial nem pisca entre dois frames. Só o
+ * primeiro repaint após frame_resize limpa a tela, no mesmo write().
+ */
+size_t encode_full(Frame *f){
+    char *p = f->out;
+
+    if(f->needs_clear){
+        memcpy(p, ANSI_CLEAR, sizeof(ANSI_CLEAR) - 1);
+        p += sizeof(ANSI_CLEAR) - 1;
+        f->needs_clear = 0;
+    } else {
+        memcpy(p, ANSI_HOME, sizeof(ANSI_HOME) - 1);
+        p += sizeof(ANSI_HOME) - 1;
+    }
+
+    for(int y = 0; y < f->height; y++){
+        p = put_cells(f, p, (size_t)y * f->width, f->width);
+        *p++ = '\n';
+    }
+    return (size_t)(p - f->out);
+}
+
+#define DELTA_TOO_LARGE ((size_t)-1)
+
+/**
+ * Codificação por diferença: para cada linha, emite apenas as sequências
+ * de células alteradas, cada uma precedida de um posicionamento do cursor.
+ * Lacunas inalteradas mais curtas que um posicionamento são reenviadas
+ * dentro da própria sequência, pois custam menos bytes que um novo salto.
+ * Retorna DELTA_TOO_LARGE se a diferença ficaria maior que um repaint
+ * completo, e 0 se nada mudou.
+ */
+size_t encode_delta(Frame *f){
+    const int width = f->width;
+    const size_t limit = f->full_bytes;
+    const int pen = f->pen;
+    char *p = f->out;
+
+    for(int y = 0; y < f->height; y++){
+        const char *cur = f->cells + (size_t)y * width;
+        const char *old = f->prev + (size_t)y * width;
+        const uint8_t *ccur = f->colors ? f->colors + (size_t)y * width : NULL;
+        const uint8_t *cold = f->colors ? f->prev_colors + (size_t)y * width : NULL;
+        int x = 0;
+
+// Célula alterada: glifo ou, com paleta, cor
+#define CHANGED(i) (cur[i] != old[i] || (ccur && ccur[i] != cold[i]))
+
+        while(x < width){
+            if(!CHANGED(x)){ x++; continue; }
+
+            // Início de uma sequência alterada; estende enquanto a próxima
+            // diferença estiver mais perto que o custo de um salto
+            int start = x, end = x + 1, gap = 0;
+            for(int i = end; i < width; i++){
+                if(CHANGED(i)){
+                    end = i + 1;
+                    gap = 0;
+                } else if(++gap >= MAX_MOVE_BYTES / 2){
+                    break;
+                }
+            }
+
+            p += put_move(p, y + 1, start + 1);
+            p = put_cells(f, p, (size_t)y * width + start, end - start);
+            x = end;
+
+            if((size_t)(p - f->out) > limit){
+                f->pen = pen;  // Nada disto será enviado
+                return DELTA_TOO_LARGE;
+            }
+        }
+#undef CHANGED
+    }
+    return (size_t)(p - f->out);
+}
+
+/**
+ * Serializa o frame em f->out, usando a codificação por diferença
+ * sempre que ela for menor que o repaint completo, e o registra como
+ * último frame enviado. Retorna o número de bytes (0 se nada mudou).
+ */
+size_t encode_frame(Frame *f){
+    // Cores com a mesma sequência SGR viram um só índice: nem trocam a
+    // cor atual nem contam como célula alterada
+    if(f->colors){
+        const uint8_t *canon = f->palette->canon;
+        for(size_t i = 0, n = (size_t)f->width * f->height; i < n; i++)
+            f->colors[i] = canon[f->colors[i]];
+    }
+
+    size_t len = f->has_prev ? encode_delta(f) : DELTA_TOO_LARGE;
+
+    if(len == 0) return 0; // nada mudou
+    if(len == DELTA_TOO_LARGE){
+        len = encode_full(f);
+        // Com cores ou glifos o tamanho do repaint varia: o último
+        // serve de limite
+        if(f->palette || f->glyphs) f->full_bytes = len;
+    }
+
+    memcpy(f->prev, f->cells, (size_t)f->width * f->height);
+    if(f->colors) memcpy(f->prev_colors, f->colors, (size_t)f->width * f->height);
+    f->has_prev = 1;
+    return len;
+}
+
+/**
+ * Gravação (--record) em um contêiner binário compacto.
+ * Todos os inteiros são little-endian.
+ *
+ *   Cabeçalho (32 bytes)
+ *     "SNVR"  u16 versão  u16 tamanho do cabeçalho
+ *     u16 largura  u16 altura  u16 FPS  u16 glifos (CHARSET_*)
+ *     u64 semente  u64 reservado
+ *
+ *   Frames, em sequência; cada um com um cabeçalho de 16 bytes
+ *     u8 tipo ('K' quadro-chave, 'D' diferença)  u8 fase
+ *     u16 largura  u16 altura  u16 reservado
+ *     u32 instante em ms desde o primeiro frame  u32 bytes de dados
+ *   seguido dos dados comprimidos:
+ *     'K': as células do frame (caracteres, ou máscaras de subpixels
+ *          com glifos), em RLE
+ *     'D': as células XOR o frame anterior, em RLE (células iguais
+ *          viram zeros, que formam longas sequências)
+ *   Um registro de tipo 'E' (sem dados) marca o fim dos frames.
+ *   Um quadro-chave é gravado a cada REC_KEY_INTERVAL frames, então
+ *   qualquer frame é reconstruído a partir de no máximo esse número de
+ *   registros.
+ *
+ *   Índice: 16 bytes por frame
+ *     u64 posição do registro no arquivo  u32 instante em ms
+ *     u8 tipo  u8 fase  u16 frames desde o último quadro-chave
+ *
+ *   Marcas: u32 por fase (GIANT a NEBULA) com a posição da primeira
+ *   marca daquela fase, mais um u32 com o número de marcas; seguem
+ *   8 bytes por mudança de fase, agrupados por fase e, em cada fase,
+ *   em ordem de frame. A n-ésima ocorrência de uma fase é lida direto.
+ *     u32 número do frame  u8 fase  3 bytes reservados
+ *
+ *   Segundos: u32 por segundo gravado, o primeiro frame com instante
+ *   maior ou igual àquele segundo
+ *
+ *   Rodapé (40 bytes, no fim do arquivo)
+ *     "SNVI"  u32 número de frames  u64 posição do índice
+ *     u32 número de marcas  u32 número de segundos
+ *     u64 posição das marcas  u64 posição dos segundos
+ *
+ * RLE: sequência de tokens, cada um iniciado por um varint h. Se h é
+ * ímpar, o byte seguinte se repete h >> 1 vezes; se é par, seguem h >> 1
+ * bytes literais. Um arquivo interrompido antes do rodapé continua
+ * legível sequencialmente.
+ *
+ * A codificação é incremental e acontece na thread de saída, nunca no
+ * laço de simulação; o arquivo é escrito por um FILE com buffer grande.
+ */
+#define REC_MAGIC "SNVR"
+#define REC_INDEX_MAGIC "SNVI"
+#define REC_VERSION 3
+#define REC_HEADER_BYTES 32
+#define REC_FRAME_HEADER_BYTES 16
+#define REC_INDEX_ENTRY_BYTES 16
+#define REC_MARK_BYTES 8
+#define REC_FOOTER_BYTES 40
+#define REC_PHASE_TABLE_BYTES ((NEBULA + 2) * 4)
+#define REC_IO_BUFFER (1 << 20)
+#define REC_KEY_INTERVAL (2 * FPS)
+
+#define REC_KEY 'K'
+#define REC_DELTA 'D'
+#define REC_END 'E'
+
+typedef struct {
+    uint64_t offset;
+    uint32_t time_ms;
+    uint8_t type;
+    uint8_t state;
+    uint16_t since_key;          // Frames desde o último quadro-chave
+} RecIndexEntry;
+
+typedef struct {
+    FILE *fp;
+    uint64_t offset;             // Posição atual no arquivo
+    uint64_t t0;                 // Instante do primeiro frame
+    int started;
+
+    int width, height;           // Dimensões do frame anterior
+    uint8_t *prev;               // Frame anterior (base das diferenças)
+    uint8_t *scratch;            // Células XOR anterior
+    uint8_t *payload;            // Dados comprimidos
+    size_t cap;                  // Células que cabem nos buffers (só cresce)
+
+    RecIndexEntry *index;
+    size_t count, index_cap;
+    int since_key;
+} Recorder;
+
+static inline uint8_t *put_u16(uint8_t *p, uint16_t v){
+    p[0] = v; p[1] = v >> 8;
+    return p + 2;
+}
+
+static inline uint8_t *put_u32(uint8_t *p, uint32_t v){
+    for(int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+    return p + 4;
+}
+
+static inline uint8_t *put_u64(uint8_t *p, uint64_t v){
+    for(int i = 0; i < 8; i++) p[i] = v >> (8 * i);
+    return p + 8;
+}
+
+static inline uint16_t get_u16(const uint8_t *p){
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t get_u32(const uint8_t *p){
+    uint32_t v = 0;
+    for(int i = 3; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static inline uint64_t get_u64(const uint8_t *p){
+    uint64_t v = 0;
+    for(int i = 7; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v){
+    while(v >= 0x80){
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// Lê um varint de [*p, end); retorna 0 se os dados acabarem no meio
+static inline int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v){
+    uint64_t r = 0;
+    for(int shift = 0; *p < end && shift < 64; shift += 7){
+        uint8_t b = *(*p)++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)){
+            *v = r;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Pior caso do RLE de n bytes: um único literal
+#define RLE_BOUND(n) ((n) + 10)
+
+/**
+ * Comprime n bytes em out (com espaço para RLE_BOUND(n)).
+ * Sequências de 3 ou mais bytes iguais viram um token de repetição.
+ */
+size_t rle_encode(const uint8_t *in, size_t n, uint8_t *out){
+    uint8_t *p = out;
+    size_t i = 0, lit = 0;   // Literais pendentes em [i - lit, i)
+
+    while(i < n){
+        size_t run = 1;
+        while(i + run < n && in[i + run] == in[i]) run++;
+
+        if(run >= 3){
+            if(lit){
+                p = put_varint(p, (uint64_t)lit << 1);
+                memcpy(p, in + i - lit, lit);
+                p += lit;
+                lit = 0;
+            }
+            p = put_varint(p, (uint64_t)run << 1 | 1);
+            *p++ = in[i];
+            i += run;
+        } else {
+            lit += run;
+            i += run;
+        }
+    }
+    if(lit){
+        p = put_varint(p, (uint64_t)lit << 1);
+        memcpy(p, in + n - lit, lit);
+        p += lit;
+    }
+    return (size_t)(p - out);
+}
+
+/**
+ * Descomprime exatamente n bytes. Se xor, combina com o conteúdo atual
+ * de out (frames de diferença). Retorna 0 se os dados forem inválidos.
+ */
+int rle_decode(const uint8_t *in, size_t len, uint8_t *out, size_t n, int xor){
+    const uint8_t *p = in, *end = in + len;
+    size_t o = 0;
+
+    while(o < n){
+        uint64_t h;
+        if(!get_varint(&p, end, &h)) return 0;
+        uint64_t k = h >> 1;
+        if(k > n - o) return 0;
+
+        if(h & 1){
+            if(p >= end) return 0;
+            uint8_t b = *p++;
+            if(xor){ if(b) for(uint64_t j = 0; j < k; j++) out[o + j] ^= b; }
+            else memset(out + o, b, k);
+        } else {
+            if((uint64_t)(end - p) < k) return 0;
+            if(xor) for(uint64_t j = 0; j < k; j++) out[o + j] ^= p[j];
+            else memcpy(out + o, p, k);
+            p += k;
+        }
+        o += k;
+    }
+    return p == end;
+}
+
+static void rec_write(Recorder *r, const void *buf, size_t len){
+    if(fwrite(buf, 1, len, r->fp) != len){
+        fprintf(stderr, "supernova: erro ao gravar: %s\n", strerror(errno));
+        exit(1);
+    }
+    r->offset += len;
+}
+
+void recorder_open(Recorder *r, const char *path, int width, int height, uint64_t seed, int charset){
+    memset(r, 0, sizeof(*r));
+    r->fp = fopen(path, "wb");
+    if(!r->fp){
+        fprintf(stderr, "supernova: não foi possível criar '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    setvbuf(r->fp, NULL, _IOFBF, REC_IO_BUFFER);
+
+    uint8_t h[REC_HEADER_BYTES] = {0}, *p = h;
+    memcpy(p, REC_MAGIC, 4); p += 4;
+    p = put_u16(p, REC_VERSION);
+    p = put_u16(p, REC_HEADER_BYTES);
+    p = put_u16(p, width);
+    p = put_u16(p, height);
+    p = put_u16(p, FPS);
+    p = put_u16(p, charset);
+    p = put_u64(p, seed);
+    rec_write(r, h, sizeof(h));
+}
+
+/**
+ * Acrescenta um frame à gravação: quadro-chave no primeiro frame e a
+ * cada mudança de dimensões, diferença em relação ao anterior nos demais.
+ */
+void recorder_frame(Recorder *r, const char *cells, int width, int height, int state, uint64_t time_ns){
+    size_t ncells = (size_t)width * height;
+    int key = !r->started || width != r->width || height != r->height
+              || r->since_key + 1 >= REC_KEY_INTERVAL;
+
+    if(!r->started){
+        r->t0 = time_ns;
+        r->started = 1;
+    }
+
+    if(RLE_BOUND(ncells) > r->cap){
+        size_t cap = RLE_BOUND(ncells) + RLE_BOUND(ncells) / 2;
+        uint8_t *prev = alloc_aligned(cap);
+        if(r->prev && !key) memcpy(prev, r->prev, ncells);
+        free(r->prev);
+        free(r->scratch);
+        free(r->payload);
+        r->prev = prev;
+        r->scratch = alloc_aligned(cap);
+        r->payload = alloc_aligned(cap);
+        r->cap = cap;
+    }
+
+    const uint8_t *src = (const uint8_t *)cells;
+    if(!key){
+        for(size_t i = 0; i < ncells; i++)
+            r->scratch[i] = src[i] ^ r->prev[i];
+        src = r->scratch;
+    }
+    size_t len = rle_encode(src, ncells, r->payload);
+
+    if(r->count == r->index_cap){
+        r->index_cap = r->index_cap ? r->index_cap * 2 : 1024;
+        r->index = realloc(r->index, r->index_cap * sizeof(*r->index));
+        if(!r->index){
+            fprintf(stderr, "supernova: sem memória para o índice da gravação\n");
+            exit(1);
+        }
+    }
+    RecIndexEntry *e = &r->index[r->count++];
+    e->offset = r->offset;
+    e->time_ms = (uint32_t)((time_ns - r->t0) / 1000000u);
+    e->type = key ? REC_KEY : REC_DELTA;
+    e->state = (uint8_t)state;
+    r->since_key = key ? 0 : r->since_key + 1;
+    e->since_key = (uint16_t)r->since_key;
+
+    uint8_t h[REC_FRAME_HEADER_BYTES], *p = h;
+    *p++ = e->type;
+    *p++ = e->state;
+    p = put_u16(p, width);
+    p = put_u16(p, height);
+    p = put_u16(p, 0);
+    p = put_u32(p, e->time_ms);
+    p = put_u32(p, (uint32_t)len);
+    rec_write(r, h, sizeof(h));
+    rec_write(r, r->payload, len);
+
+    memcpy(r->prev, cells, ncells);
+    r->width = width;
+    r->height = height;
+}
+
+static void put_index_entry(uint8_t *p, const RecIndexEntry *e){
+    p = put_u64(p, e->offset);
+    p = put_u32(p, e->time_ms);
+    *p++ = e->type;
+    *p++ = e->state;
+    put_u16(p, e->since_key);
+}
+
+/**
+ * Serializa as tabelas de busca (índice, marcas de fase e segundos) a
+ * partir das entradas do índice, no formato do arquivo. Usado pela
+ * gravação e pela reprodução de arquivos sem rodapé. Retorna um bloco
+ * alocado com as três tabelas em sequência.
+ */
+uint8_t *rec_build_tables(const RecIndexEntry *e, size_t count,
+                          size_t *index_bytes, uint32_t *nmarks, size_t *marks_bytes,
+                          uint32_t *nseconds, size_t *seconds_bytes){
+    uint32_t marks = 0, start[NEBULA + 2] = {0};
+    for(size_t i = 0; i < count; i++){
+        if(i > 0 && e[i].state == e[i - 1].state) continue;
+        start[e[i].state + 1]++;
+        marks++;
+    }
+    for(int st = GIANT; st <= NEBULA; st++)
+        start[st + 1] += start[st];
+    uint32_t seconds = count ? e[count - 1].time_ms / 1000 + 1 : 0;
+
+    *index_bytes = count * REC_INDEX_ENTRY_BYTES;
+    *marks_bytes = REC_PHASE_TABLE_BYTES + (size_t)marks * REC_MARK_BYTES;
+    *seconds_bytes = (size_t)seconds * 4;
+    *nmarks = marks;
+    *nseconds = seconds;
+
+    uint8_t *block = malloc(*index_bytes + *marks_bytes + *seconds_bytes + 1);
+    if(!block){
+        fprintf(stderr, "supernova: sem memória para o índice da gravação\n");
+        exit(1);
+    }
+
+    uint8_t *p = block;
+    for(size_t i = 0; i < count; i++, p += REC_INDEX_ENTRY_BYTES)
+        put_index_entry(p, &e[i]);
+
+    // Marcas agrupadas por fase: start[st] avança a cada marca escrita
+    for(int st = GIANT; st <= NEBULA + 1; st++)
+        p = put_u32(p, start[st]);
+    for(size_t i = 0; i < count; i++){
+        if(i > 0 && e[i].state == e[i - 1].state) continue;
+        uint8_t *m = p + (size_t)start[e[i].state]++ * REC_MARK_BYTES;
+        memset(m, 0, REC_MARK_BYTES);
+        put_u32(m, (uint32_t)i);
+        m[4] = e[i].state;
+    }
+    p += (size_t)marks * REC_MARK_BYTES;
+
+    size_t f = 0;
+    for(uint32_t sec = 0; sec < seconds; sec++){
+        while(f < count && e[f].time_ms < sec * 1000u) f++;
+        p = put_u32(p, (uint32_t)f);
+    }
+    return block;
+}
+
+// Grava o marcador de fim, as tabelas de busca e o rodapé e fecha o arquivo
+void recorder_close(Recorder *r){
+    uint8_t end[REC_FRAME_HEADER_BYTES] = { REC_END };
+    rec_write(r, end, sizeof(end));
+
+    size_t index_bytes, marks_bytes, seconds_bytes;
+    uint32_t nmarks, nseconds;
+    uint8_t *tables = rec_build_tables(r->index, r->count, &index_bytes,
+                                       &nmarks, &marks_bytes, &nseconds, &seconds_bytes);
+
+    uint64_t index_offset = r->offset;
+    uint64_t marks_offset = index_offset + index_bytes;
+    uint64_t seconds_offset = marks_offset + marks_bytes;
+    rec_write(r, tables, index_bytes + marks_bytes + seconds_bytes);
+    free(tables);
+
+    uint8_t foot[REC_FOOTER_BYTES], *p = foot;
+    memcpy(p, REC_INDEX_MAGIC, 4); p += 4;
+    p = put_u32(p, (uint32_t)r->count);
+    p = put_u64(p, index_offset);
+    p = put_u32(p, nmarks);
+    p = put_u32(p, nseconds);
+    p = put_u64(p, marks_offset);
+    p = put_u64(p, seconds_offset);
+    rec_write(r, foot, sizeof(foot));
+
+    if(fclose(r->fp) != 0)
+        fprintf(stderr, "supernova: erro ao fechar a gravação: %s\n", strerror(errno));
+    free(r->prev);
+    free(r->scratch);
+    free(r->payload);
+    free(r->index);
+}
+
+/**
+ * Exportação asciicast v2 (--asciicast), o formato do asciinema:
+ * uma linha JSON de cabeçalho e depois um evento por frame,
+ *
+ *   [segundos, "o", "bytes enviados ao terminal"]
+ *
+ * mais [segundos, "r", "LxA"] quando as dimensões mudam. Os eventos são
+ * exatamente os bytes do codificador (repaint ou diferença), e cada linha
+ * é descarregada ao ser escrita: o arquivo é válido a qualquer momento,
+ * mesmo com a simulação ainda rodando.
+ */
+typedef struct {
+    FILE *fp;
+    uint64_t t0;                 // Instante do primeiro frame
+    int started;
+    int width, height;           // Dimensões anunciadas
+    char *buf;                   // Evento escapado
+    size_t cap;
+} Cast;
+
+// Maior expansão de um byte no JSON: "\u001b"
+#define CAST_ESCAPE_BYTES 6
+
+/**
+ * Escapa len bytes como string JSON em dst, que deve comportar
+ * CAST_ESCAPE_BYTES * len. O terminal converte '\n' em "\r\n" (ONLCR)
+ * mas o reprodutor não, então a conversão é feita aqui. Bytes >= 0x80
+ * passam inalterados: a saída é sempre UTF-8 válido.
+ */
+static size_t cast_escape(char *dst, const char *src, size_t len){
+    static const char hex[] = "0123456789abcdef";
+    char *p = dst;
+
+    for(size_t i = 0; i < len; i++){
+        unsigned char c = (unsigned char)src[i];
+        if(c == '\n'){
+            memcpy(p, "\\r\\n", 4);
+            p += 4;
+        } else if(c == '"' || c == '\\'){
+            *p++ = '\\';
+            *p++ = (char)c;
+        } else if(c < 0x20 || c == 0x7f){
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[c >> 4];
+            p[5] = hex[c & 15];
+            p += 6;
+        } else {
+            *p++ = (char)c;
+        }
+    }
+    return (size_t)(p - dst);
+}
+
+static void cast_reserve(Cast *c, size_t len){
+    size_t need = CAST_ESCAPE_BYTES * len + 1;
+    if(need <= c->cap) return;
+    free(c->buf);
+    c->cap = need + need / 2;
+    c->buf = alloc_aligned(c->cap);
+}
+
+static void cast_flush(Cast *c){
+    if(ferror(c->fp) || fflush(c->fp) != 0){
+        fprintf(stderr, "supernova: erro ao gravar o asciicast: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+void cast_open(Cast *c, const char *path){
+    memset(c, 0, sizeof(*c));
+    c->fp = fopen(path, "w");
+    if(!c->fp){
+        fprintf(stderr, "supernova: não foi possível criar '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+}
+
+// Cabeçalho, escrito com o primeiro frame, que define as dimensões
+static void cast_header(Cast *c, int width, int height){
+    const char *term = getenv("TERM");
+    if(!term || !*term) term = "xterm";
+    cast_reserve(c, strlen(term));
+    size_t n = cast_escape(c->buf, term, strlen(term));
+
+    // A linha abaixo da imagem recebe o '\n' final de cada repaint
+    fprintf(c->fp, "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld, "
+                   "\"env\": {\"TERM\": \"%.*s\"}}\n",
+            width, height + 1, (long long)time(NULL), (int)n, c->buf);
+    c->width = width;
+    c->height = height;
+}
+
+/**
+ * Acrescenta a saída de um frame. O instante é relativo ao primeiro
+ * frame, em segundos, vindo de time_ns: relógio real no terminal,
+ * tempo simulado em --headless.
+ */
+void cast_frame(Cast *c, const char *out, size_t len, int width, int height, uint64_t time_ns){
+    if(!c->started){
+        cast_header(c, width, height);
+        c->t0 = time_ns;
+        c->started = 1;
+    }
+    double t = (double)(time_ns - c->t0) / 1e9;
+
+    if(width != c->width || height != c->height){
+        c->width = width;
+        c->height = height;
+        fprintf(c->fp, "[%.6f, \"r\", \"%dx%d\"]\n", t, width, height + 1);
+    }
+    if(len > 0){
+        cast_reserve(c, len);
+        size_t n = cast_escape(c->buf, out, len);
+        fprintf(c->fp, "[%.6f, \"o\", \"", t);
+        fwrite(c->buf, 1, n, c->fp);
+        fputs("\"]\n", c->fp);
+    }
+    cast_flush(c);
+}
+
+void cast_close(Cast *c){
+    if(!c->fp) return;
+    if(fclose(c->fp) != 0)
+        fprintf(stderr, "supernova: erro ao fechar o asciicast: %s\n", strerror(errno));
+    free(c->buf);
+}
+
+/**
+ * Estatísticas de execução: linha de estado (--status) e fluxo JSON
+ * Lines (--stats), uma linha por frame entregue:
+ *
+ *   {"frame": n, "phase": "EXPLOSION", "time": s, "live": n, "steps": n,
+ *    "update_ns": n, "render_ns": n, "bytes": n, "writes": n, "dropped": n}
+ *
+ * As medições do laço de simulação chegam em Frame::stats; bytes
+ * entregues a write() (frame e linha de estado; 0 sem terminal) e
+ * chamadas write() são contados na entrega, e
+ * dropped é o total de frames descartados pelo anel até então. Tudo
+ * isso acontece em quem entrega o frame (a thread de saída, salvo com
+ * --sync ou --headless), e o arquivo é descarregado a cada FPS linhas
+ * entregues.
+ */
+typedef struct {
+    FILE *fp;                    // --stats, ou NULL
+    int status;                  // Linha de estado (--status)
+    uint64_t writes;             // Chamadas write() ao terminal até agora
+    size_t last_bytes;           // Bytes escritos no terminal no frame anterior
+    uint64_t lines;              // Linhas gravadas em fp
+    _Atomic uint64_t *dropped;   // FrameRing::dropped, ou NULL (saída síncrona)
+} Stats;
+
+void stats_open(Stats *st, const char *path){
+    st->fp = fopen(path, "w");
+    if(!st->fp){
+        fprintf(stderr, "supernova: não foi possível criar '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+}
+
+void stats_close(Stats *st){
+    if(!st->fp) return;
+    if(fclose(st->fp) != 0)
+        fprintf(stderr, "supernova: erro ao fechar as estatísticas: %s\n", strerror(errno));
+    st->fp = NULL;
+}
+
+static inline uint64_t stats_dropped(const Stats *st){
+    return st->dropped ? atomic_load_explicit(st->dropped, memory_order_relaxed) : 0;
+}
+
+/**
+ * Escreve em p a linha de estado do frame f, na linha abaixo da imagem.
+ * Os bytes mostrados são os do frame anterior, já que os deste incluem
+ * a própria linha. Com cores, volta antes à cor padrão. Retorna o
+ * número de bytes (no máximo STATUS_BYTES).
+ */
+static size_t put_status(const Stats *st, Frame *f, char *p){
+    const FrameStats *fs = &f->stats;
+    char text[STATUS_COLS + 1];
+    char *start = p;
+
+    int n = snprintf(text, sizeof(text),
+                     "%-9s  t %.2f s  vivas %d  update %llu us  render %llu us  %zu bytes  %llu writes  %llu descartados",
+                     state_names[f->state], fs->clock, fs->live,
+                     (unsigned long long)(fs->update_ns / 1000), (unsigned long long)(fs->render_ns / 1000),
+                     st->last_bytes, (unsigned long long)st->writes, (unsigned long long)stats_dropped(st));
+    if(n < 0) n = 0;
+    if(n > STATUS_COLS) n = STATUS_COLS;
+    if(n > f->width) n = f->width;
+
+    p += put_move(p, f->height + 1, 1);
+    if(f->palette && f->pen != COLOR_DEFAULT){
+        memcpy(p, ANSI_RESET, sizeof(ANSI_RESET) - 1);
+        p += sizeof(ANSI_RESET) - 1;
+        f->pen = COLOR_DEFAULT;
+    }
+    memcpy(p, text, n);
+    p += n;
+    memcpy(p, ANSI_ERASE_LINE, sizeof(ANSI_ERASE_LINE) - 1);
+    p += sizeof(ANSI_ERASE_LINE) - 1;
+    return (size_t)(p - start);
+}
+
+// Uma linha JSON com as medições do frame f
+static void stats_frame(Stats *st, const Frame *f, size_t bytes, int writes){
+    const FrameStats *fs = &f->stats;
+
+    fprintf(st->fp, "{\"frame\": %llu, \"phase\": \"%s\", \"time\": %.4f, \"live\": %d, \"steps\": %d, "
+                    "\"update_ns\": %llu, \"render_ns\": %llu, \"bytes\": %zu, \"writes\": %d, \"dropped\": %llu}\n",
+            (unsigned long long)fs->frame, state_names[f->state], fs->clock, fs->live, fs->steps,
+            (unsigned long long)fs->update_ns, (unsigned long long)fs->render_ns,
+            bytes, writes, (unsigned long long)stats_dropped(st));
+
+    // Conta as linhas entregues: os frames de número múltiplo de FPS
+    // podem ter sido descartados pelo anel
+    if(++st->lines % FPS == 0 && (ferror(st->fp) || fflush(st->fp) != 0)){
+        fprintf(stderr, "supernova: erro ao gravar as estatísticas: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+/**
+ * Destinos de um frame já desenhado: terminal, gravação e asciicast.
+ * Usado pelo laço síncrono, pelo modo --headless e pela thread de saída.
+ */
+typedef struct {
+    int fd;                      // Terminal, ou -1 (--headless)
+    Recorder *rec;               // --record, ou NULL
+    Cast *cast;                  // --asciicast, ou NULL
+    Stats *stats;                // --stats ou --status, ou NULL
+} Output;
+
+/**
+ * Codifica o frame uma vez e entrega os mesmos bytes a cada destino.
+ * A linha de estado vai logo depois dos bytes do frame, no mesmo
+ * write(), e só para o terminal.
+ */
+void present_frame(const Output *o, Frame *f){
+    Stats *st = o->stats;
+    uint64_t span = trace_begin();
+    size_t len = encode_frame(f);
+    size_t total = len;
+    int writes = 0;
+
+    if(st && st->status && o->fd >= 0) total += put_status(st, f, f->out + len);
+    trace_end(TRACE_ENCODE, span);
+
+    if(o->fd >= 0 && total > 0){
+        span = trace_begin();
+        writes = write_all(o->fd, f->out, total);
+        trace_end(TRACE_FLUSH, span);
+    }
+    if(o->cast){
+        span = trace_begin();
+        cast_frame(o->cast, f->out, len, f->width, f->height, f->time_ns);
+        trace_end(TRACE_CAST, span);
+    }
+    if(o->rec){
+        span = trace_begin();
+        recorder_frame(o->rec, f->cells, f->width, f->height, f->state, f->time_ns);
+        trace_end(TRACE_RECORD, span);
+    }
+
+    if(st){
+        size_t written = o->fd >= 0 ? total : 0;
+        if(writes > 0) st->writes += writes;
+        st->last_bytes = written;
+        if(st->fp) stats_frame(st, f, written, writes);
+    }
+}
+
+/**
+ * Deixa o cursor abaixo da imagem de f (e da linha de estado, se
+ * status), com a cor padrão, para o prompt.
+ */
+void park_cursor(int fd, const Frame *f, int status){
+    char park[MAX_MOVE_BYTES + sizeof(ANSI_RESET) + 1];
+    int n = put_move(park, f->height + 1, 1);
+    if(f->palette){
+        memcpy(park + n, ANSI_RESET, sizeof(ANSI_RESET) - 1);
+        n += sizeof(ANSI_RESET) - 1;
+    }
+    if(status) park[n++] = '\n';
+    write_all(fd, park, (size_t)n);
+}
+
+/**
+ * Gravação aberta para reprodução. O arquivo é mapeado em memória
+ * (mmap) e lido diretamente do mapa: só as páginas efetivamente
+ * tocadas são carregadas, e as tabelas de busca são usadas no lugar,
+ * sem cópia. Buscas por frame, instante ou fase custam O(1) nas
+ * tabelas, mais a decodificação de no máximo REC_KEY_INTERVAL registros.
+ */
+typedef struct {
+    const uint8_t *map;
+    size_t size;
+    int width, height;
+    int charset;                 // CHARSET_*
+    uint64_t seed;
+
+    const uint8_t *index;        // count entradas de REC_INDEX_ENTRY_BYTES
+    uint32_t count;
+    const uint8_t *marks;        // nmarks entradas de REC_MARK_BYTES
+    uint32_t nmarks;
+    uint32_t phase_start[NEBULA + 2];  // Primeira marca de cada fase
+    const uint8_t *seconds;      // nseconds entradas u32
+    uint32_t nseconds;
+
+    uint8_t *owned;              // Tabelas reconstruídas (arquivo sem rodapé)
+} Recording;
+
+static inline uint64_t rec_offset(const Recording *rc, uint32_t i){
+    return get_u64(rc->index + (size_t)i * REC_INDEX_ENTRY_BYTES);
+}
+
+static inline uint32_t rec_time(const Recording *rc, uint32_t i){
+    return get_u32(rc->index + (size_t)i * REC_INDEX_ENTRY_BYTES + 8);
+}
+
+static inline uint16_t rec_since_key(const Recording *rc, uint32_t i){
+    return get_u16(rc->index + (size_t)i * REC_INDEX_ENTRY_BYTES + 14);
+}
+
+/**
+ * Valida o registro que começa em off. Retorna o tipo ('K', 'D' ou 'E')
+ * ou 0 se o registro estiver truncado ou inválido.
+ */
+static int rec_record(const Recording *rc, uint64_t off, int *width, int *height,
+                      uint32_t *time_ms, const uint8_t **data, size_t *len){
+    if(off > rc->size || rc->size - off < REC_FRAME_HEADER_BYTES) return 0;
+
+    const uint8_t *h = rc->map + off;
+    if(h[0] == REC_END) return REC_END;
+    if(h[0] != REC_KEY && h[0] != REC_DELTA) return 0;
+
+    *width = get_u16(h + 2);
+    *height = get_u16(h + 4);
+    *time_ms = get_u32(h + 8);
+    *len = get_u32(h + 12);
+    *data = h + REC_FRAME_HEADER_BYTES;
+    if(*width == 0 || *height == 0 || rc->size - off - REC_FRAME_HEADER_BYTES < *len) return 0;
+    return h[0];
+}
+
+/**
+ * Lê a tabela por fase no início das marcas em p e aponta rc->marks
+ * para as marcas. Retorna 0 se a tabela não for coerente.
+ */
+static int rec_load_marks(Recording *rc, const uint8_t *p, uint32_t nmarks){
+    for(int st = GIANT; st <= NEBULA + 1; st++){
+        rc->phase_start[st] = get_u32(p + st * 4);
+        if(rc->phase_start[st] > nmarks || (st > GIANT && rc->phase_start[st] < rc->phase_start[st - 1]))
+            return 0;
+    }
+    if(rc->phase_start[GIANT] != 0 || rc->phase_start[NEBULA + 1] != nmarks) return 0;
+
+    rc->nmarks = nmarks;
+    rc->marks = p + REC_PHASE_TABLE_BYTES;
+    return 1;
+}
+
+/**
+ * Arquivo sem rodapé (gravação interrompida): percorre os registros e
+ * reconstrói as tabelas em memória, no mesmo formato do arquivo.
+ */
+static int rec_rebuild_tables(Recording *rc){
+    RecIndexEntry *e = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t off = get_u16(rc->map + 6);
+    int since_key = 0;
+
+    for(;;){
+        int w, h, type;
+        uint32_t t;
+        const uint8_t *data;
+        size_t len;
+
+        type = rec_record(rc, off, &w, &h, &t, &data, &len);
+        if(type != REC_KEY && type != REC_DELTA) break;
+        if(rc->map[off + 1] > NEBULA) break;
+
+        if(count == cap){
+            cap = cap ? cap * 2 : 1024;
+            RecIndexEntry *n = realloc(e, cap * sizeof(*e));
+            if(!n){ free(e); return 0; }
+            e = n;
+        }
+        since_key = type == REC_KEY ? 0 : since_key + 1;
+        e[count].offset = off;
+        e[count].time_ms = t;
+        e[count].type = (uint8_t)type;
+        e[count].state = rc->map[off + 1];
+        e[count].since_key = (uint16_t)(since_key > 0xffff ? 0xffff : since_key);
+        count++;
+        off += REC_FRAME_HEADER_BYTES + len;
+    }
+    // Um prefixo sem quadro-chave não é decodificável
+    if(count == 0 || e[0].type != REC_KEY){
+        free(e);
+        return 0;
+    }
+
+    size_t index_bytes, marks_bytes, seconds_bytes;
+    uint32_t nmarks;
+    rc->owned = rec_build_tables(e, count, &index_bytes, &nmarks, &marks_bytes,
+                                 &rc->nseconds, &seconds_bytes);
+    rc->count = (uint32_t)count;
+    rc->index = rc->owned;
+    rc->seconds = rc->owned + index_bytes + marks_bytes;
+    free(e);
+    return rec_load_marks(rc, rc->owned + index_bytes, nmarks);
+}
+
+// Mapeia a gravação; retorna 0 (com mensagem) se não for possível
+int rec_open(Recording *rc, const char *path){
+    memset(rc, 0, sizeof(*rc));
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0){
+        fprintf(stderr, "supernova: não foi possível abrir '%s': %s\n", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return 0;
+    }
+    rc->size = (size_t)st.st_size;
+    if(rc->size < REC_HEADER_BYTES){
+        fprintf(stderr, "supernova: '%s' não é uma gravação compatível\n", path);
+        close(fd);
+        return 0;
+    }
+
+    void *map = mmap(NULL, rc->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        fprintf(stderr, "supernova: mmap de '%s' falhou: %s\n", path, strerror(errno));
+        return 0;
+    }
+    rc->map = map;
+
+    const uint8_t *h = rc->map;
+    // A versão 2 só difere nas marcas (em ordem de frame): suas tabelas
+    // são reconstruídas em vez de lidas do rodapé
+    int version = get_u16(h + 4);
+    if(memcmp(h, REC_MAGIC, 4) != 0 || (version != REC_VERSION && version != 2)){
+        fprintf(stderr, "supernova: '%s' não é uma gravação compatível\n", path);
+        munmap(map, rc->size);
+        return 0;
+    }
+    rc->width = get_u16(h + 8);
+    rc->height = get_u16(h + 10);
+    rc->charset = get_u16(h + 14);
+    rc->seed = get_u64(h + 16);
+    if(rc->charset > CHARSET_HALF){
+        fprintf(stderr, "supernova: '%s' usa glifos desconhecidos\n", path);
+        munmap(map, rc->size);
+        return 0;
+    }
+
+    // Tabelas do rodapé, se o arquivo foi finalizado e elas são coerentes
+    int have_tables = 0;
+    if(version == REC_VERSION && rc->size >= REC_HEADER_BYTES + REC_FOOTER_BYTES){
+        const uint8_t *f = rc->map + rc->size - REC_FOOTER_BYTES;
+        uint64_t end = rc->size - REC_FOOTER_BYTES;
+        uint32_t count = get_u32(f + 4), nmarks = get_u32(f + 16), nseconds = get_u32(f + 20);
+        uint64_t io = get_u64(f + 8), mo = get_u64(f + 24), so = get_u64(f + 32);
+
+        if(memcmp(f, REC_INDEX_MAGIC, 4) == 0
+           && io <= end && (end - io) / REC_INDEX_ENTRY_BYTES >= count
+           && mo <= end && end - mo >= REC_PHASE_TABLE_BYTES
+           && (end - mo - REC_PHASE_TABLE_BYTES) / REC_MARK_BYTES >= nmarks
+           && so <= end && (end - so) / 4 >= nseconds && count > 0
+           && rec_load_marks(rc, rc->map + mo, nmarks)){
+            rc->count = count;
+            rc->index = rc->map + io;
+            rc->nseconds = nseconds;
+            rc->seconds = rc->map + so;
+            have_tables = 1;
+        }
+    }
+    if(!have_tables && !rec_rebuild_tables(rc)){
+        fprintf(stderr, "supernova: gravação '%s' vazia ou corrompida\n", path);
+        munmap(map, rc->size);
+        return 0;
+    }
+    return 1;
+}
+
+void rec_close(Recording *rc){
+    munmap((void *)rc->map, rc->size);
+    free(rc->owned);
+}
+
+// Primeiro frame com instante >= t_ms (O(1) pela tabela de segundos),
+// ou -1 se a tabela apontar para fora da gravação
+int64_t rec_find_time(const Recording *rc, uint32_t t_ms){
+    uint32_t sec = t_ms / 1000;
+    if(sec >= rc->nseconds) return rc->count - 1;
+
+    uint32_t i = get_u32(rc->seconds + (size_t)sec * 4);
+    if(i >= rc->count) return -1;
+    while(i + 1 < rc->count && rec_time(rc, i) < t_ms) i++;
+    return i;
+}
+
+// Frame onde começa a n-ésima (1-based) ocorrência da fase (O(1) pelas
+// marcas agrupadas por fase); -1 se não houver, -2 se a marca for inválida
+int64_t rec_find_phase(const Recording *rc, int state, int nth){
+    uint32_t first = rc->phase_start[state], n = rc->phase_start[state + 1] - first;
+    if((uint32_t)nth > n) return -1;
+
+    const uint8_t *e = rc->marks + (size_t)(first + nth - 1) * REC_MARK_BYTES;
+    if(e[4] != state || get_u32(e) >= rc->count) return -2;
+    return get_u32(e);
+}
+
+/**
+ * Decodifica o frame i em f, que deve conter o frame i - 1 se i for uma
+ * diferença. Retorna 0 se o registro for inválido.
+ */
+static int rec_decode(const Recording *rc, uint32_t i, Frame *f){
+    int w, h;
+    uint32_t t;
+    const uint8_t *data;
+    size_t len;
+    int type = rec_record(rc, rec_offset(rc, i), &w, &h, &t, &data, &len);
+
+    if(type != REC_KEY && type != REC_DELTA) return 0;
+    if(type == REC_DELTA && (w != f->width || h != f->height)) return 0;
+
+    if(type == REC_KEY && (w != f->width || h != f->height))
+        frame_resize(f, w, h);
+    f->state = rc->map[rec_offset(rc, i) + 1];
+    return rle_decode(data, len, (uint8_t *)f->cells, (size_t)w * h, type == REC_DELTA);
+}
+
+/**
+ * Posiciona f no frame i: decodifica a partir do último quadro-chave,
+ * no máximo REC_KEY_INTERVAL registros, sem exibir nada.
+ */
+static int rec_seek(const Recording *rc, uint32_t i, Frame *f){
+    if(i >= rc->count || rec_since_key(rc, i) > i) return 0;
+
+    uint32_t k = i - rec_since_key(rc, i);
+    for(uint32_t j = k; j <= i; j++)
+        if(!rec_decode(rc, j, f)) return 0;
+    return 1;
+}
+
+/**
+ * Interpreta --seek: segundos ("12.5") ou fase ("EXPLOSION", "NEBULA:2")
+ * Retorna o frame inicial ou -1 com mensagem de erro.
+ */
+int64_t rec_parse_seek(const Recording *rc, const char *path, const char *spec){
+    int64_t i = -1;
+    int st;
 
-#define WIDTH 90
-#define HEIGHT 32
-#define FPS 30
+    for(st = GIANT; st <= NEBULA; st++){
+        size_t n = strlen(state_names[st]);
+        if(strncasecmp(spec, state_names[st], n) != 0 || (spec[n] && spec[n] != ':')) continue;
 
-// Estados evolutivos da estrela
-#define GIANT 0
-#define COLLAPSE 1
-#define BOUNCE 2
-#define EXPLOSION 3
-#define NEBULA 4
+        int nth = spec[n] ? parse_int("--seek", spec + n + 1, 1, 1 << 30) : 1;
+        i = rec_find_phase(rc, st, nth);
+        if(i == -1){
+            fprintf(stderr, "supernova: a gravação não tem a ocorrência %d de %s\n", nth, state_names[st]);
+            return -1;
+        }
+        break;
+    }
+    if(st > NEBULA){
+        float t = parse_float("--seek", spec, 0, 4e6f);
+        i = rec_find_time(rc, (uint32_t)(t * 1000));
+    }
+
+    if(i < 0){
+        fprintf(stderr, "supernova: gravação '%s' corrompida\n", path);
+        return -1;
+    }
+    return i;
+}
+
+/**
+ * Reprodução (--play): percorre a gravação mapeada e exibe cada frame no
+ * instante em que foi gravado, pelo mesmo codificador do terminal. Com
+ * --seek, começa direto no frame pedido; com --headless, não espera e
+ * só alimenta o asciicast (conversão de gravações).
+ */
+int run_play(const char *path, const char *seek, const Output *o){
+    Recording rc;
+    if(!rec_open(&rc, path)) return 1;
+
+    uint32_t first = 0;
+    if(seek){
+        int64_t i = rec_parse_seek(&rc, path, seek);
+        if(i < 0){
+            rec_close(&rc);
+            return 1;
+        }
+        first = (uint32_t)i;
+    }
+
+    madvise((void *)rc.map, rc.size, MADV_SEQUENTIAL);
+
+    Frame frame = {0};
+    static Glyphs glyphs;
+    if(rc.charset != CHARSET_ASCII){
+        glyphs_init(&glyphs, rc.charset);
+        frame.glyphs = &glyphs;
+    }
+    int ok = rec_seek(&rc, first, &frame);
+    uint64_t start = now_ns();
+    uint32_t t0 = rec_time(&rc, first);
+
+    for(uint32_t i = first; ok && !quit_pending && i < rc.count; i++){
+        if(i > first && !rec_decode(&rc, i, &frame)){
+            ok = 0;
+            break;
+        }
 
-#define MAX_PARTICLES 450
+        uint64_t due = start + (uint64_t)(rec_time(&rc, i) - t0) * 1000000u;
+        uint64_t now = now_ns();
+        if(o->fd >= 0 && due > now){
+            uint64_t wait = due - now;
+            struct timespec ts = { (time_t)(wait / 1000000000u), (long)(wait % 1000000000u) };
+            nanosleep(&ts, NULL);
+        }
+        frame.time_ns = (uint64_t)rec_time(&rc, i) * 1000000u;
+        present_frame(o, &frame);
+
+        if(trace_pending){
+            trace_pending = 0;
+            trace_dump();
+        }
+    }
+
+    if(o->fd >= 0) park_cursor(o->fd, &frame, 0);
+    if(!ok) fprintf(stderr, "supernova: gravação '%s' corrompida\n", path);
+    free(frame.block);
+    rec_close(&rc);
+    return ok ? 0 : 1;
+}
+
+/**
+ * Saída assíncrona: uma thread dedicada escreve no terminal, alimentada
+ * por um anel lock-free de frames com um produtor (o laço de simulação)
+ * e um consumidor (a thread de saída). O produtor nunca espera: se o
+ * terminal não acompanha (SSH, console serial, tmux pausado), o frame
+ * não enviado mais antigo é descartado em favor do novo.
+ *
+ * O anel guarda até RING_SLOTS frames, os de número [tail, head), em
+ * RING_SLOTS + 1 posições. Ambos os contadores são atômicos:
+ *   - o produtor escreve na posição head e publica com head + 1;
+ *   - o consumidor toma o frame tail com um CAS de tail para tail + 1;
+ *   - com o anel cheio, o produtor descarta o frame mais antigo com o
+ *     mesmo CAS, e quem vencer fica com ele. Os demais continuam
+ *     pendentes e na ordem.
+ * A posição extra é a que o consumidor pode estar copiando (reading):
+ * o produtor só a alcança se o consumidor ficar parado um frame inteiro
+ * no meio da cópia, e nesse caso descarta o frame novo.
+ *
+ * A thread de saída dorme em um pipe (wake) quando o anel está vazio; o
+ * produtor escreve um byte a cada frame publicado, sem bloquear.
+ *
+ * O anel carrega a imagem (células), não bytes codificados: a codificação
+ * por diferença é feita pelo consumidor em relação ao último frame que
+ * ele realmente enviou, então descartar frames nunca corrompe a tela.
+ */
+#define RING_NONE UINT64_MAX
 
 typedef struct {
-    float x, y;
-    float vx, vy;
-    float life;
-} Particle;
+    _Alignas(CACHE_LINE) int width, height;
+    int phase;                   // Frame::state
+    uint64_t time_ns;
+    FrameStats stats;
+    char *cells;
+    uint8_t *colors;             // Logo após cells no mesmo bloco
+    size_t cap;                  // Células que cabem em cells (só cresce)
+} FrameSlot;
 
 typedef struct {
-    float radius;            // Raio visível da estrela
-    float core_radius;       // Tamanho do núcleo compacto (estrela de nêutrons)
-    float explosion_radius;  // Raio da frente de choque da supernova
-    float velocity;          // Velocidade de contração durante colapso
-    float time;              // Tempo interno do estágio
-    float density;           // (Reservado para futuras expansões científicas)
-    int state;
+    FrameSlot slots[RING_SLOTS + 1];
 
-    Particle particles[MAX_PARTICLES];
-    int particle_count;
+    _Alignas(CACHE_LINE) _Atomic uint64_t head;  // Próximo frame do produtor
+    _Alignas(CACHE_LINE) _Atomic uint64_t tail;  // Próximo frame do consumidor
+    _Atomic uint64_t reading;                    // Frame em cópia, ou RING_NONE
+    Frame out;                                   // Estado da codificação por diferença
+    Output sink;
+    int wake[2];                                 // Pipe que acorda a thread de saída
 
-} Star;
+    _Atomic uint64_t dropped;                    // Frames descartados
+    _Atomic int stop;
+    pthread_t thread;
+} FrameRing;
 
-// Função utilitária
-float clamp(float v, float a, float b){
-    if(v < a) return a;
-    if(v > b) return b;
-    return v;
+// Acorda a thread de saída; um pipe cheio já a acordará
+static void ring_wake(FrameRing *r){
+    ssize_t n = write(r->wake[1], "", 1);
+    (void)n;
 }
 
 /**
- * Geração das partículas ejetadas pela explosão.
- * Representam o "ejecta" rico em elementos pesados.
+ * Produtor: copia a imagem de f para o anel. Nunca bloqueia.
+ * Retorna 0 se o frame teve de ser descartado.
  */
-void spawn_particles(Star *s){
-    s->particle_count = MAX_PARTICLES;
-    float cx = WIDTH / 2.0;
-    float cy = HEIGHT / 2.0;
+int ring_publish(FrameRing *r, const Frame *f){
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t t = atomic_load(&r->tail);
 
-    for(int i=0;i<MAX_PARTICLES;i++){
-        float angle = ((float)rand()/RAND_MAX) * 2*M_PI;
-        float speed = 10 + rand()%40; // velocidades variadas → explosão irregular
+    // Anel cheio: descarta o mais antigo, a menos que o consumidor o tome antes
+    if(h - t == RING_SLOTS && atomic_compare_exchange_strong(&r->tail, &t, t + 1))
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
 
-        s->particles[i].x = cx;
-        s->particles[i].y = cy;
-        s->particles[i].vx = cos(angle) * speed;
-        s->particles[i].vy = sin(angle) * speed * 0.55;
-        s->particles[i].life = 2.5 + ((float)rand()/RAND_MAX)*1.5;
+    if(h >= RING_SLOTS + 1 && atomic_load(&r->reading) == h - (RING_SLOTS + 1)){
+        // O consumidor ainda está copiando justamente esta posição
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return 0;
     }
-}
 
-// Limpa terminal
-void clear(){
-    printf("\033[H\033[J");
+    FrameSlot *slot = &r->slots[h % (RING_SLOTS + 1)];
+    size_t ncells = (size_t)f->width * f->height;
+    if(ncells > slot->cap){
+        free(slot->cells);
+        slot->cap = ncells + ncells / 2;
+        slot->cells = alloc_aligned(2 * slot->cap);
+        slot->colors = (uint8_t *)slot->cells + slot->cap;
+    }
+    memcpy(slot->cells, f->cells, ncells);
+    if(f->colors) memcpy(slot->colors, f->colors, ncells);
+    slot->width = f->width;
+    slot->height = f->height;
+    slot->phase = f->state;
+    slot->time_ns = f->time_ns;
+    slot->stats = f->stats;
+
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+    ring_wake(r);
+    return 1;
 }
 
 /**
- * Renderização da estrela e fenômenos associados
- * Cada símbolo representa um estado físico aproximado:
- * #  = envelope estelar estável
- * @  = estrela colapsando
- * *  = choque sendo propagado
- * +  = partículas de ejecta
- * .  = gás difuso (nebulosa)
- * O  = estrela de nêutrons remanescente
+ * Consumidor: toma o próximo frame do anel para r->out.
+ * Retorna 1 se há um frame novo, 0 se o anel está vazio.
  */
-void draw_star(Star *s){
-    clear();
+static int ring_take(FrameRing *r){
+    uint64_t t = atomic_load(&r->tail);
+    for(;;){
+        if(t == atomic_load_explicit(&r->head, memory_order_acquire)) return 0;
 
-    float cx = WIDTH / 2.0;
-    float cy = HEIGHT / 2.0;
+        // Anuncia a cópia antes de tomar o frame; se o produtor o
+        // descartou primeiro, o CAS falha e t passa a ser o seguinte
+        atomic_store(&r->reading, t);
+        if(atomic_compare_exchange_strong(&r->tail, &t, t + 1)) break;
+    }
 
-    for(int y = 0; y < HEIGHT; y++){
-        for(int x = 0; x < WIDTH; x++){
+    const FrameSlot *slot = &r->slots[t % (RING_SLOTS + 1)];
+    if(slot->width != r->out.width || slot->height != r->out.height){
+        // Tamanho novo: a tela é limpa e repintada por inteiro
+        frame_resize(&r->out, slot->width, slot->height);
+    }
+    memcpy(r->out.cells, slot->cells, (size_t)slot->width * slot->height);
+    if(r->out.colors) memcpy(r->out.colors, slot->colors, (size_t)slot->width * slot->height);
+    r->out.state = slot->phase;
+    r->out.time_ns = slot->time_ns;
+    r->out.stats = slot->stats;
 
-            // Correção da proporção vertical do terminal
-            float dy = (y - cy) * 1.5;
-            float dx = (x - cx);
-            float d = sqrt(dx*dx + dy*dy);
+    atomic_store_explicit(&r->reading, RING_NONE, memory_order_release);
+    return 1;
+}
 
-            char pixel = ' ';
+static void *writer_thread(void *arg){
+    FrameRing *r = arg;
+    trace_thread("saída");
 
-            if(s->state == GIANT){
-                // Supergigante massiva pulsando
-                if(d <= s->radius) pixel = '#';
-            }
+    for(;;){
+        while(ring_take(r))
+            present_frame(&r->sink, &r->out);
+        if(atomic_load_explicit(&r->stop, memory_order_acquire)){
+            // Os frames publicados antes do pedido de parada
+            while(ring_take(r))
+                present_frame(&r->sink, &r->out);
+            break;
+        }
 
-            else if(s->state == COLLAPSE){
-                // Contração do núcleo e esmagamento gravitacional
-                if(d <= s->radius) pixel = '@';
-            }
+        char buf[64];
+        if(read(r->wake[0], buf, sizeof(buf)) < 0 && errno != EINTR) break;
+    }
+    return NULL;
+}
 
-            else if(s->state == BOUNCE){
-                // Frente de choque inicial
-                if(d <= s->radius && d >= s->radius - 1.5) pixel = '*';
-            }
+// Inicia a thread de saída; a codificação usa a paleta e os glifos de f
+void writer_start(FrameRing *r, const Output *sink, const Frame *f){
+    memset(r, 0, sizeof(*r));
+    r->sink = *sink;
+    r->out.palette = f->palette;
+    r->out.glyphs = f->glyphs;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->reading, RING_NONE);
+    atomic_init(&r->dropped, 0);
+    atomic_init(&r->stop, 0);
 
-            else if(s->state == EXPLOSION){
-                // Onda de choque se expandindo rapidamente
-                if(d <= s->explosion_radius && d >= s->explosion_radius - 1.6)
-                    pixel = '*';
-            }
+    if(pipe(r->wake) != 0 || fcntl(r->wake[1], F_SETFL, O_NONBLOCK) != 0){
+        fprintf(stderr, "supernova: não foi possível criar a thread de saída: %s\n", strerror(errno));
+        exit(1);
+    }
 
-            else if(s->state == NEBULA){
-                // Remanescente difuso da supernova
-                if(d <= s->explosion_radius && rand()%12==0)
-                    pixel = '.';
-            }
+    if(pthread_create(&r->thread, NULL, writer_thread, r) != 0){
+        fprintf(stderr, "supernova: não foi possível criar a thread de saída\n");
+        exit(1);
+    }
+}
 
-            // Núcleo compacto restante — estrela de nêutrons
-            if(d <= s->core_radius)
-                pixel = 'O';
+// Envia os frames pendentes e encerra a thread de saída
+void writer_stop(FrameRing *r){
+    atomic_store_explicit(&r->stop, 1, memory_order_release);
+    ring_wake(r);
+    pthread_join(r->thread, NULL);
+    close(r->wake[0]);
+    close(r->wake[1]);
+}
 
-            // Partículas de ejecta
-            for(int i=0;i<s->particle_count;i++){
-                int px = (int)s->particles[i].x;
-                int py = (int)s->particles[i].y;
+/**
+ * Núcleo da integração das partículas.
+ * Todas as partículas de entrada estão vivas, então o laço não tem
+ * desvios: três multiplicações-somas e a contagem das que morreram
+ * neste passo, que o compilador vetoriza; sem vetorização o mesmo laço
+ * roda escalar. Retorna o número de partículas que morreram.
+ */
+static int integrate_particles(int n, float dt,
+                               float *restrict x, float *restrict y,
+                               const float *restrict vx, const float *restrict vy,
+                               float *restrict life){
+    x = __builtin_assume_aligned(x, CACHE_LINE);
+    y = __builtin_assume_aligned(y, CACHE_LINE);
+    vx = __builtin_assume_aligned(vx, CACHE_LINE);
+    vy = __builtin_assume_aligned(vy, CACHE_LINE);
+    life = __builtin_assume_aligned(life, CACHE_LINE);
 
-                if(px == x && py == y && s->particles[i].life > 0)
-                    pixel = '+';
-            }
+    int dead = 0;
+    for(int i=0;i<n;i++){
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        life[i] -= dt;
 
-            putchar(pixel);
-        }
-        putchar('\n');
+        // life <= 0 testado sobre os bits do float: para valores finitos
+        // equivale à comparação, mas não é uma operação de ponto
+        // flutuante que "pode gerar exceção", o que impediria o GCC
+        // (com -ftrapping-math, o padrão) de vetorizar a redução
+        int32_t bits;
+        memcpy(&bits, &life[i], sizeof(bits));
+        dead += bits <= 0;
     }
+    return dead;
 }
 
 /**
- * Atualiza movimento das partículas ejetadas
+ * Compactação: remove as partículas mortas preservando a ordem das
+ * vivas. Começa na primeira morta, então o prefixo vivo não é copiado.
  */
-void update_particles(Star *s, float dt){
-    for(int i=0;i<s->particle_count;i++){
-        if(s->particles[i].life <= 0) continue;
+static void compact_particles(Particles *p){
+    int n = p->count, j = 0;
 
-        s->particles[i].x += s->particles[i].vx * dt;
-        s->particles[i].y += s->particles[i].vy * dt;
-        s->particles[i].life -= dt;
+    while(j < n && p->life[j] > 0) j++;
+
+    for(int i = j + 1; i < n; i++){
+        if(p->life[i] <= 0) continue;
+        p->x[j] = p->x[i];
+        p->y[j] = p->y[i];
+        p->vx[j] = p->vx[i];
+        p->vy[j] = p->vy[i];
+        p->life[j] = p->life[i];
+        j++;
     }
+    p->count = j;
+}
+
+/**
+ * Atualiza movimento das partículas ejetadas
+ */
+void update_particles(Star *s, float dt){
+    Particles *p = &s->particles;
+    uint64_t span = trace_begin();
+    if(integrate_particles(p->count, dt, p->x, p->y, p->vx, p->vy, p->life) > 0)
+        compact_particles(p);
+    trace_end(TRACE_PARTICLES, span);
 }
 
 /**
@@ -228,6 +3308,7 @@ void update_particles(Star *s, float dt){
  */
 void update_star(Star *s, float dt){
     s->time += dt;
+    s->tick++;
 
     // Fase de Supergigante instável
     if(s->state == GIANT){
@@ -263,6 +3344,7 @@ void update_star(Star *s, float dt){
             s->time = 0;
             s->explosion_radius = 3;
             spawn_particles(s);
+            s->cycle++;
         }
     }
 
@@ -291,8 +3373,563 @@ void update_star(Star *s, float dt){
     }
 }
 
-int main(){
-    srand(time(NULL));
+/**
+ * Forma fechada da evolução (--analytic): posiciona a estrela no
+ * instante absoluto t sem integrar nada. Cada fase de update_star tem
+ * solução exata em função do tempo decorrido u dentro dela:
+ *
+ *   GIANT      r = 9 + 1.5 sin(3u)              por GIANT_TIME
+ *   COLLAPSE   r = r0 - 20u²  (aceleração 40)   até r = 3
+ *   BOUNCE     r = 3 + 25u                      por BOUNCE_TIME
+ *   EXPLOSION  choque = 3 + 30u                 até 32
+ *   NEBULA     choque = 32 + 6u                 até 42
+ *
+ * e o ciclo se repete com período fixo. As partículas só são lançadas
+ * (spawn_particles) quando t cruza para outro ciclo, ou nem isso no
+ * modo procedural; dentro do ciclo, a
+ * posição de cada uma sai de Star::age na renderização. Por isso o
+ * custo independe de t e de dt, não há erro acumulado e t pode andar
+ * para trás. O resultado difere da integração apenas pelo erro de
+ * discretização desta.
+ */
+void star_at(Star *s, double t){
+    const double r0 = 9 + sin(3 * GIANT_TIME) * 1.5;   // Raio no fim da fase GIANT
+    const double collapse = sqrt((r0 - 3) / 20);
+    const double period = GIANT_TIME + collapse + BOUNCE_TIME + EXPLOSION_TIME + NEBULA_TIME;
+
+    if(t < 0) t = 0;
+    s->clock = t;
+    s->tick = (uint64_t)(t * FPS);
+
+    uint64_t cycle = (uint64_t)(t / period);
+    double u = t - (double)cycle * period;
+
+    // Antes da explosão ficam visíveis as partículas do ciclo anterior,
+    // paradas com a idade que tinham no fim da nebulosa
+    s->core_radius = cycle > 0 ? 2 : 0;
+    s->age = cycle > 0 ? EXPLOSION_TIME + NEBULA_TIME : 0;
+    s->explosion_radius = cycle > 0 ? 42 : 0;
+    int exploded = u >= period - EXPLOSION_TIME - NEBULA_TIME;
+    uint64_t spawns = cycle + exploded;   // Valor de Star::cycle após o último lançamento
+
+    if(spawns != s->cycle){
+        if(spawns > 0 && s->procedural){
+            // Nada a gerar: a renderização refaz cada lançamento
+            s->spawn_key = rng_key(s->seed, RNG_SPAWN(spawns - 1));
+            s->particles.count = s->particles.capacity;
+        } else if(spawns > 0){
+            s->cycle = spawns - 1;
+            spawn_particles(s);
+        } else {
+            s->particles.count = 0;
+        }
+        s->cycle = spawns;
+    }
+
+    if(u < GIANT_TIME){
+        s->state = GIANT;
+        s->time = u;
+        s->radius = 9 + sin(u * 3) * 1.5;
+    } else if((u -= GIANT_TIME) < collapse){
+        s->state = COLLAPSE;
+        s->time = u;
+        s->velocity = 40 * u;
+        s->radius = r0 - 20 * u * u;
+    } else if((u -= collapse) < BOUNCE_TIME){
+        s->state = BOUNCE;
+        s->time = u;
+        s->core_radius = 2;
+        s->radius = 3 + 25 * u;
+    } else if((u -= BOUNCE_TIME) < EXPLOSION_TIME){
+        s->state = EXPLOSION;
+        s->time = u;
+        s->core_radius = 2;
+        s->explosion_radius = 3 + 30 * u;
+        s->age = u;
+    } else {
+        u -= EXPLOSION_TIME;
+        s->state = NEBULA;
+        s->time = u;
+        s->core_radius = 2;
+        s->explosion_radius = 32 + 6 * u;
+        s->age = EXPLOSION_TIME + u;
+    }
+}
+
+/**
+ * Avança a simulação dt segundos (negativo só na forma fechada)
+ */
+void advance_star(Star *s, float dt){
+    uint64_t span = trace_begin();
+    if(s->analytic){
+        star_at(s, s->clock + dt);
+    } else {
+        update_star(s, dt);
+        s->clock += dt;
+    }
+    trace_end(TRACE_UPDATE, span);
+}
+
+/**
+ * Benchmark: tempos de um frame do modo --bench
+ */
+typedef struct {
+    uint64_t update_ns;
+    uint64_t render_ns;          // draw_star
+    uint64_t single_ns;          // draw_star em uma única thread (com --threads)
+    uint64_t reference_ns;       // draw_star_reference (apenas camadas)
+    uint64_t layers_ns;          // núcleo especializado (apenas camadas)
+    uint64_t encode_ns;          // serialização para o terminal
+    uint64_t bytes;
+    int state;                   // fase exibida neste frame
+} BenchSample;
+
+int cmp_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Percentil q (0..1) de um array já ordenado
+uint64_t percentile(const uint64_t *v, int n, double q){
+    int i = (int)ceil(q * n) - 1;
+    if(i < 0) i = 0;
+    if(i >= n) i = n - 1;
+    return v[i];
+}
+
+/**
+ * Resume um subconjunto de amostras (uma fase, ou todas com state < 0)
+ * em uma linha da tabela. totals é um buffer de trabalho de n posições.
+ */
+void bench_report_line(const char *name, const BenchSample *v, int n, int state, uint64_t *totals){
+    uint64_t upd = 0, ren = 0, enc = 0, bytes = 0, ref = 0, lay = 0;
+    int m = 0;
+
+    for(int i = 0; i < n; i++){
+        if(state >= 0 && v[i].state != state) continue;
+        upd += v[i].update_ns;
+        ren += v[i].render_ns;
+        enc += v[i].encode_ns;
+        bytes += v[i].bytes;
+        ref += v[i].reference_ns;
+        lay += v[i].layers_ns;
+        totals[m++] = v[i].update_ns + v[i].render_ns + v[i].encode_ns;
+    }
+    if(m == 0) return;
+
+    qsort(totals, m, sizeof(*totals), cmp_u64);
+    printf("%-10s %7d %11.0f %11.0f %11.0f %11.1f %11.1f %9.0f %11.0f %11.0f %7.1fx\n",
+           name, m, (double)upd / m, (double)ren / m, (double)enc / m,
+           percentile(totals, m, 0.50) / 1e3, percentile(totals, m, 0.99) / 1e3,
+           (double)bytes / m, (double)ref / m, (double)lay / m,
+           lay ? (double)ref / lay : 0.0);
+}
+
+/**
+ * Modo --bench: executa frames advance_star + draw_star + codificação em
+ * memória, sem pausas e sem escrever no terminal, e imprime a vazão e a
+ * distribuição dos tempos de frame, no total e por fase.
+ *
+ * Cada frame também tem suas camadas contínuas renderizadas pelo
+ * renderizador de referência e pelo núcleo especializado da fase, fora
+ * do tempo de frame; as últimas colunas comparam os dois e o relatório
+ * acusa qualquer frame em que as imagens divirjam.
+ *
+ * Com --threads, cada frame é antes renderizado em uma única thread,
+ * também fora do tempo de frame, para medir o ganho do pool e conferir
+ * que as duas imagens são iguais.
+ */
+void run_bench(Star *s, const Geometry *g, Frame *f, RenderPool *pool, int frames){
+    BenchSample *v = malloc((size_t)frames * sizeof(*v));
+    uint64_t *totals = malloc((size_t)frames * sizeof(*totals));
+    size_t ncells = (size_t)f->width * f->height;
+    char *ref = malloc(ncells);
+    char *lay = malloc(ncells);
+    char *one = malloc(ncells);
+    int mismatches = 0, split = 0;
+    RenderPool single;
+    if(!v || !totals || !ref || !lay || !one){
+        fprintf(stderr, "supernova: sem memória para %d amostras\n", frames);
+        exit(1);
+    }
+
+    pool_init(&single, 1);
+    single.density = pool->density;
+
+    float dt = 1.0 / FPS;
+    uint64_t start = now_ns();
+
+    for(int i = 0; i < frames; i++){
+        uint64_t t0 = now_ns();
+        advance_star(s, dt);
+        uint64_t t1 = now_ns();
+        draw_star(s, g, f, pool);
+        uint64_t t2 = now_ns();
+        size_t len = encode_frame(f);
+        uint64_t t3 = now_ns();
+
+        // A mesma imagem, já codificada, refeita em uma única thread
+        v[i].single_ns = 0;
+        if(pool->nthreads > 1){
+            memcpy(one, f->cells, ncells);
+            uint64_t t = now_ns();
+            draw_star(s, g, f, &single);
+            v[i].single_ns = now_ns() - t;
+            if(memcmp(one, f->cells, ncells) != 0) split++;
+        }
+
+        v[i].update_ns = t1 - t0;
+        v[i].render_ns = t2 - t1;
+        v[i].encode_ns = t3 - t2;
+        v[i].bytes = len;
+        v[i].state = s->state;
+
+        uint64_t t4 = now_ns();
+        draw_star_reference(s, g, ref);
+        uint64_t t5 = now_ns();
+        render_kernels[s->state](s, g, lay, 0, f->height);
+        uint64_t t6 = now_ns();
+
+        v[i].reference_ns = t5 - t4;
+        v[i].layers_ns = t6 - t5;
+        if(memcmp(ref, lay, ncells) != 0) mismatches++;
+    }
+
+    double elapsed = (now_ns() - start) / 1e9;
+
+    printf("supernova --bench: %d frames, grade %dx%d, %d partículas, semente %llu, %d thread%s\n",
+           frames, f->width, f->height, s->particles.capacity, (unsigned long long)s->seed,
+           pool->nthreads, pool->nthreads > 1 ? "s" : "");
+    printf("%.1f frames/s (%.3f s)\n\n", frames / elapsed, elapsed);
+    printf("%-10s %7s %11s %11s %11s %11s %11s %9s %11s %11s %8s\n",
+           "fase", "frames", "update ns", "render ns", "encode ns", "p50 us", "p99 us", "bytes",
+           "ref ns", "kernel ns", "ganho");
+
+    for(int st = GIANT; st <= NEBULA; st++)
+        bench_report_line(state_names[st], v, frames, st, totals);
+    bench_report_line("total", v, frames, -1, totals);
+
+    if(pool->nthreads > 1){
+        uint64_t ren = 0, one_ns = 0;
+        for(int i = 0; i < frames; i++){
+            ren += v[i].render_ns;
+            one_ns += v[i].single_ns;
+        }
+        printf("\nrender em 1 thread: %.0f ns, em %d threads: %.0f ns (ganho %.2fx)\n",
+               (double)one_ns / frames, pool->nthreads, (double)ren / frames,
+               ren ? (double)one_ns / ren : 0.0);
+    }
+    if(mismatches)
+        printf("\nATENÇÃO: %d frames divergem do renderizador de referência\n", mismatches);
+    if(split)
+        printf("\nATENÇÃO: %d frames divergem entre 1 e %d threads\n", split, pool->nthreads);
+
+    pool_destroy(&single);
+    free(v);
+    free(totals);
+    free(ref);
+    free(lay);
+    free(one);
+}
+
+void on_sigwinch(int sig){
+    (void)sig;
+    resize_pending = 1;
+}
+
+void on_quit(int sig){
+    (void)sig;
+    quit_pending = 1;
+}
+
+void on_trace(int sig){
+    (void)sig;
+    trace_pending = 1;
+}
+
+/**
+ * Consulta o tamanho do terminal via TIOCGWINSZ.
+ * Retorna 0 se stdout não for um terminal ou a consulta falhar.
+ */
+int terminal_size(int *cols, int *rows){
+    struct winsize ws;
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0 || ws.ws_row == 0)
+        return 0;
+    *cols = ws.ws_col;
+    *rows = ws.ws_row;
+    return 1;
+}
+
+/**
+ * Ajusta as dimensões automáticas da grade ao terminal. A última linha
+ * do terminal fica livre: o '\n' do fim do frame não pode rolar a tela.
+ */
+void fit_terminal(Config *c){
+    int cols, rows;
+    if(!terminal_size(&cols, &rows)) return;
+
+    if(c->auto_width) c->width = cols < MAX_DIM ? cols : MAX_DIM;
+    if(c->auto_height) c->height = rows - 1 < 1 ? 1 : (rows - 1 < MAX_DIM ? rows - 1 : MAX_DIM);
+}
+
+/**
+ * Nível de cor do terminal, quando não há --color: sem terminal na
+ * saída padrão não há cor; NO_COLOR desliga, COLORTERM=truecolor|24bit
+ * indica RGB direto, TERM com "256color" indica 256 cores e qualquer
+ * outro TERM, exceto "dumb", 16 cores.
+ */
+int detect_color(void){
+    const char *v;
+    if(!isatty(STDOUT_FILENO)) return COLOR_NONE;
+    if((v = getenv("NO_COLOR")) && *v) return COLOR_NONE;
+    if((v = getenv("COLORTERM")) && (!strcmp(v, "truecolor") || !strcmp(v, "24bit"))) return COLOR_TRUE;
+
+    v = getenv("TERM");
+    if(!v || !*v || !strcmp(v, "dumb")) return COLOR_NONE;
+    if(strstr(v, "256color")) return COLOR_256;
+    return COLOR_16;
+}
+
+int parse_color(const char *v){
+    if(!strcmp(v, "auto")) return -1;
+    if(!strcmp(v, "truecolor") || !strcmp(v, "24bit")) return COLOR_TRUE;
+    if(!strcmp(v, "256")) return COLOR_256;
+    if(!strcmp(v, "16")) return COLOR_16;
+    if(!strcmp(v, "none")) return COLOR_NONE;
+    fprintf(stderr, "supernova: --color inválido: '%s' (esperado auto, truecolor, 256, 16 ou none)\n", v);
+    exit(2);
+}
+
+int parse_density(const char *v){
+    if(!strcmp(v, "off")) return DENSITY_OFF;
+    if(!strcmp(v, "count")) return DENSITY_COUNT;
+    if(!strcmp(v, "life")) return DENSITY_LIFE;
+    fprintf(stderr, "supernova: --density inválido: '%s' (esperado off, count ou life)\n", v);
+    exit(2);
+}
+
+int parse_charset(const char *v){
+    if(!strcmp(v, "ascii")) return CHARSET_ASCII;
+    if(!strcmp(v, "braille")) return CHARSET_BRAILLE;
+    if(!strcmp(v, "half")) return CHARSET_HALF;
+    fprintf(stderr, "supernova: --charset inválido: '%s' (esperado ascii, braille ou half)\n", v);
+    exit(2);
+}
+
+void usage(FILE *out){
+    fprintf(out,
+        "uso: supernova [opções]\n"
+        "  --width N       largura da grade em colunas (padrão: terminal ou %d)\n"
+        "  --height N      altura da grade em linhas (padrão: terminal ou %d)\n"
+        "  --particles N   partículas de ejecta por explosão (padrão %d)\n"
+        "  --aspect F      proporção altura/largura da célula (padrão %.1f)\n"
+        "  --bench N       executa N frames sem terminal e mede o desempenho\n"
+        "  --seed N        semente do gerador (padrão: relógio; 1 no --bench)\n"
+        "  --threads N     threads de renderização (padrão 1)\n"
+        "  --sync          escreve no terminal no próprio laço de simulação\n"
+        "  --record ARQ    grava os frames exibidos em ARQ\n"
+        "  --play ARQ      reproduz uma gravação feita com --record\n"
+        "  --seek POS      com --play: começa em POS segundos ou em FASE[:n]\n"
+        "  --asciicast ARQ exporta a saída como asciicast v2 (asciinema)\n"
+        "  --headless      sem terminal e sem esperas: simula o mais rápido possível\n"
+        "  --frames N      encerra após N frames\n"
+        "  --analytic      evolução em forma fechada, sem integração passo a passo\n"
+        "  --speed F       com --analytic: velocidade da simulação (negativa volta no tempo)\n"
+        "  --start T       com --analytic: começa no instante T segundos\n"
+        "  --procedural    forma fechada sem guardar partículas (até %d)\n"
+        "  --color MODO    auto, truecolor, 256, 16 ou none (padrão auto)\n"
+        "  --charset MODO  ascii, braille (2x4 subpixels) ou half (1x2)\n"
+        "  --density MODO  partículas pela densidade: off, count ou life (peso pela vida)\n"
+        "  --status        linha de estado abaixo da imagem\n"
+        "  --stats ARQ     medições de cada frame em ARQ (JSON Lines)\n"
+        "  --trace ARQ     trace do pipeline em ARQ (Chrome/Perfetto), na saída ou com SIGUSR1\n"
+        "  --help          mostra esta ajuda\n"
+        "Ambiente: SUPERNOVA_WIDTH, SUPERNOVA_HEIGHT, SUPERNOVA_PARTICLES,\n"
+        "SUPERNOVA_ASPECT (a linha de comando tem precedência); a detecção\n"
+        "de cores usa NO_COLOR, COLORTERM e TERM.\n",
+        DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_PARTICLES, DEFAULT_ASPECT, MAX_PROCEDURAL_PARTICLES);
+}
+
+void parse_config(Config *c, int argc, char **argv){
+    const char *v;
+
+    c->width = DEFAULT_WIDTH;
+    c->height = DEFAULT_HEIGHT;
+    c->particles = DEFAULT_PARTICLES;
+    c->aspect = DEFAULT_ASPECT;
+    c->auto_width = 1;
+    c->auto_height = 1;
+    c->bench_frames = 0;
+    c->seed = 0;
+    c->has_seed = 0;
+    c->threads = 1;
+    c->sync_output = 0;
+    c->record_path = NULL;
+    c->play_path = NULL;
+    c->seek = NULL;
+    c->asciicast_path = NULL;
+    c->headless = 0;
+    c->max_frames = 0;
+    c->analytic = 0;
+    c->procedural = 0;
+    c->color = -1;
+    c->charset = CHARSET_ASCII;
+    c->density = DENSITY_OFF;
+    c->stats_path = NULL;
+    c->status = 0;
+    c->trace_path = NULL;
+    c->speed = 1;
+    c->start = 0;
+
+    if((v = getenv("SUPERNOVA_WIDTH")) && *v){
+        c->width = parse_int("SUPERNOVA_WIDTH", v, 1, MAX_DIM);
+        c->auto_width = 0;
+    }
+    if((v = getenv("SUPERNOVA_HEIGHT")) && *v){
+        c->height = parse_int("SUPERNOVA_HEIGHT", v, 1, MAX_DIM);
+        c->auto_height = 0;
+    }
+    if((v = getenv("SUPERNOVA_PARTICLES")) && *v) c->particles = parse_int("SUPERNOVA_PARTICLES", v, 0, MAX_PROCEDURAL_PARTICLES);
+    if((v = getenv("SUPERNOVA_ASPECT")) && *v) c->aspect = parse_float("SUPERNOVA_ASPECT", v, 0.1f, 10.0f);
+
+    enum { OPT_WIDTH = 256, OPT_HEIGHT, OPT_PARTICLES, OPT_ASPECT, OPT_BENCH, OPT_SEED, OPT_THREADS, OPT_SYNC, OPT_RECORD, OPT_PLAY, OPT_SEEK,
+           OPT_ASCIICAST, OPT_HEADLESS, OPT_FRAMES, OPT_ANALYTIC, OPT_SPEED, OPT_START,
+           OPT_PROCEDURAL, OPT_COLOR, OPT_CHARSET, OPT_DENSITY, OPT_STATUS, OPT_STATS, OPT_TRACE, OPT_HELP };
+    static const struct option opts[] = {
+        { "width",     required_argument, NULL, OPT_WIDTH },
+        { "height",    required_argument, NULL, OPT_HEIGHT },
+        { "particles", required_argument, NULL, OPT_PARTICLES },
+        { "aspect",    required_argument, NULL, OPT_ASPECT },
+        { "bench",     required_argument, NULL, OPT_BENCH },
+        { "seed",      required_argument, NULL, OPT_SEED },
+        { "threads",   required_argument, NULL, OPT_THREADS },
+        { "sync",      no_argument,       NULL, OPT_SYNC },
+        { "record",    required_argument, NULL, OPT_RECORD },
+        { "play",      required_argument, NULL, OPT_PLAY },
+        { "seek",      required_argument, NULL, OPT_SEEK },
+        { "asciicast", required_argument, NULL, OPT_ASCIICAST },
+        { "headless",  no_argument,       NULL, OPT_HEADLESS },
+        { "frames",    required_argument, NULL, OPT_FRAMES },
+        { "analytic",  no_argument,       NULL, OPT_ANALYTIC },
+        { "speed",     required_argument, NULL, OPT_SPEED },
+        { "start",     required_argument, NULL, OPT_START },
+        { "procedural", no_argument,      NULL, OPT_PROCEDURAL },
+        { "color",     required_argument, NULL, OPT_COLOR },
+        { "charset",   required_argument, NULL, OPT_CHARSET },
+        { "density",   required_argument, NULL, OPT_DENSITY },
+        { "status",    no_argument,       NULL, OPT_STATUS },
+        { "stats",     required_argument, NULL, OPT_STATS },
+        { "trace",     required_argument, NULL, OPT_TRACE },
+        { "help",      no_argument,       NULL, OPT_HELP },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "", opts, NULL)) != -1){
+        switch(opt){
+            case OPT_WIDTH:
+                c->width = parse_int("--width", optarg, 1, MAX_DIM);
+                c->auto_width = 0;
+                break;
+            case OPT_HEIGHT:
+                c->height = parse_int("--height", optarg, 1, MAX_DIM);
+                c->auto_height = 0;
+                break;
+            case OPT_PARTICLES: c->particles = parse_int("--particles", optarg, 0, MAX_PROCEDURAL_PARTICLES); break;
+            case OPT_ASPECT:    c->aspect = parse_float("--aspect", optarg, 0.1f, 10.0f); break;
+            case OPT_BENCH:     c->bench_frames = parse_int("--bench", optarg, 1, 100000000); break;
+            case OPT_SEED:
+                c->seed = parse_u64("--seed", optarg);
+                c->has_seed = 1;
+                break;
+            case OPT_THREADS:   c->threads = parse_int("--threads", optarg, 1, MAX_THREADS); break;
+            case OPT_SYNC:      c->sync_output = 1; break;
+            case OPT_RECORD:    c->record_path = optarg; break;
+            case OPT_PLAY:      c->play_path = optarg; break;
+            case OPT_SEEK:      c->seek = optarg; break;
+            case OPT_ASCIICAST: c->asciicast_path = optarg; break;
+            case OPT_HEADLESS:  c->headless = 1; break;
+            case OPT_FRAMES:    c->max_frames = parse_int("--frames", optarg, 1, 1000000000); break;
+            case OPT_ANALYTIC:  c->analytic = 1; break;
+            case OPT_SPEED:     c->speed = parse_float("--speed", optarg, -100.0f, 100.0f); break;
+            case OPT_START:     c->start = parse_float("--start", optarg, 0, 1e7f); break;
+            case OPT_PROCEDURAL:
+                c->procedural = 1;
+                c->analytic = 1;  // A posição só existe em forma fechada
+                break;
+            case OPT_COLOR:     c->color = parse_color(optarg); break;
+            case OPT_CHARSET:   c->charset = parse_charset(optarg); break;
+            case OPT_DENSITY:   c->density = parse_density(optarg); break;
+            case OPT_STATUS:    c->status = 1; break;
+            case OPT_STATS:     c->stats_path = optarg; break;
+            case OPT_TRACE:     c->trace_path = optarg; break;
+            case OPT_HELP:      usage(stdout); exit(0);
+            default:            usage(stderr); exit(2);
+        }
+    }
+    if(optind < argc){
+        fprintf(stderr, "supernova: argumento inesperado: '%s'\n", argv[optind]);
+        usage(stderr);
+        exit(2);
+    }
+    if(!c->procedural && c->particles > MAX_PARTICLES){
+        fprintf(stderr, "supernova: mais de %d partículas exige --procedural\n", MAX_PARTICLES);
+        exit(2);
+    }
+    if(!c->analytic && (c->speed != 1 || c->start != 0)){
+        fprintf(stderr, "supernova: --speed e --start exigem --analytic\n");
+        exit(2);
+    }
+    if((c->stats_path || c->status) && (c->play_path || c->bench_frames)){
+        fprintf(stderr, "supernova: --stats e --status não se aplicam a --play nem a --bench\n");
+        exit(2);
+    }
+}
+
+int main(int argc, char **argv){
+    Config cfg;
+    parse_config(&cfg, argc, argv);
+
+    // O benchmark e o modo --headless não usam o terminal: a grade é a
+    // explícita ou a padrão
+    if(!cfg.bench_frames && !cfg.headless) fit_terminal(&cfg);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigwinch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+
+    sa.sa_handler = on_quit;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Com --trace, SIGUSR1 grava o trace sem interromper a execução
+    if(cfg.trace_path){
+        trace_open(cfg.trace_path);
+        sa.sa_handler = on_trace;
+        sigaction(SIGUSR1, &sa, NULL);
+    }
+
+    Output out = { cfg.headless ? -1 : STDOUT_FILENO, NULL, NULL, NULL };
+    static Cast cast;
+    if(cfg.asciicast_path && !cfg.bench_frames){
+        cast_open(&cast, cfg.asciicast_path);
+        out.cast = &cast;
+    }
+
+    if(cfg.play_path){
+        int rc = run_play(cfg.play_path, cfg.seek, &out);
+        cast_close(&cast);
+        trace_dump();
+        return rc;
+    }
+
+    // Sem --seed: semente do relógio (o benchmark usa 1 para que as
+    // execuções sejam comparáveis entre si)
+    if(!cfg.has_seed)
+        cfg.seed = cfg.bench_frames ? 1 : mix64((uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32));
 
     Star s;
     s.radius = 9;
@@ -301,15 +3938,184 @@ int main(){
     s.velocity = 0;
     s.time = 0;
     s.state = GIANT;
-    s.particle_count = 0;
+    s.seed = cfg.seed;
+    s.tick = 0;
+    s.cycle = 0;
+    s.analytic = cfg.analytic;
+    s.procedural = cfg.procedural;
+    s.clock = 0;
+    s.age = 0;
+    s.spawn_key = 0;
+    if(s.procedural){
+        memset(&s.particles, 0, sizeof(s.particles));
+        s.particles.capacity = cfg.particles;
+    } else {
+        particles_init(&s.particles, cfg.particles);
+    }
+    if(s.analytic) star_at(&s, cfg.start);
 
-    float dt = 1.0 / FPS;
+    // Cores: --color ou a capacidade do terminal; o benchmark só as usa
+    // se pedidas, para que os números não dependam do terminal
+    static Palette palette;
+    int level = cfg.color >= 0 ? cfg.color : cfg.bench_frames || cfg.headless ? COLOR_NONE : detect_color();
+    if(level != COLOR_NONE) palette_init(&palette, level);
 
-    while(1){
-        update_star(&s, dt);
-        draw_star(&s);
-        usleep(1000000 / FPS);
+    // Glifos: a estrela é renderizada em uma tela de subx x suby
+    // subpixels por célula (o benchmark usa sempre ASCII)
+    static Glyphs glyphs;
+    int subx = 1, suby = 1;
+    if(cfg.charset != CHARSET_ASCII && !cfg.bench_frames){
+        glyphs_init(&glyphs, cfg.charset);
+        subx = glyphs.sx;
+        suby = glyphs.sy;
     }
 
+    Frame frame = {0};
+    frame.palette = level != COLOR_NONE ? &palette : NULL;
+    frame.glyphs = subx * suby > 1 ? &glyphs : NULL;
+    frame_resize(&frame, cfg.width, cfg.height);
+
+    Frame canvas = {0};
+    canvas.palette = frame.palette;
+    if(frame.glyphs) canvas_resize(&canvas, cfg.width * subx, cfg.height * suby);
+
+    Geometry geo = {0};
+    set_geometry(&geo, cfg.width, cfg.height, cfg.aspect, subx, suby);
+
+    RenderPool pool;
+    pool_init(&pool, cfg.threads);
+    pool.density = cfg.density;
+
+    if(cfg.bench_frames){
+        run_bench(&s, &geo, &frame, &pool, cfg.bench_frames);
+        pool_destroy(&pool);
+        trace_dump();
+        return 0;
+    }
+
+    const float dt = 1.0 / FPS;
+    const uint64_t step_ns = 1000000000ull / FPS;
+    int drawn = 0;
+
+    static Stats stats;
+    if(cfg.stats_path || cfg.status){
+        if(cfg.stats_path) stats_open(&stats, cfg.stats_path);
+        stats.status = cfg.status;
+        out.stats = &stats;
+    }
+
+    static Recorder rec;
+    if(cfg.record_path){
+        recorder_open(&rec, cfg.record_path, cfg.width, cfg.height, cfg.seed,
+                      frame.glyphs ? cfg.charset : CHARSET_ASCII);
+        out.rec = &rec;
+    }
+
+    /*
+     * --headless: sem terminal e sem relógio. Cada passo de física gera
+     * um frame, entregue na hora à gravação e ao asciicast com o tempo
+     * simulado como instante, então os arquivos reproduzem em velocidade
+     * real mesmo que a geração tenha sido muito mais rápida.
+     */
+    while(cfg.headless && !quit_pending && (!cfg.max_frames || drawn < cfg.max_frames)){
+        uint64_t t0 = now_ns();
+        advance_star(&s, dt * cfg.speed);
+        uint64_t t1 = now_ns();
+        frame.stats.live = render_frame(&s, &geo, &canvas, &frame, &pool);
+        frame.stats.render_ns = now_ns() - t1;
+        frame.stats.update_ns = t1 - t0;
+        frame.stats.steps = 1;
+        frame.stats.frame = drawn;
+        frame.stats.clock = s.clock;
+        frame.time_ns = (uint64_t)drawn * step_ns;
+        present_frame(&out, &frame);
+        drawn++;
+
+        if(trace_pending){
+            trace_pending = 0;
+            trace_dump();
+        }
+    }
+
+    /*
+     * Laço de passo fixo: o relógio monotônico alimenta um acumulador e a
+     * física avança em passos exatos de 1/FPS, quantos couberem no tempo
+     * real decorrido. A renderização acontece uma vez por volta do laço;
+     * se renderizar ficou caro, a volta seguinte executa vários passos e
+     * os frames intermediários simplesmente não são desenhados. O tempo
+     * simulado acompanha o relógio de parede independentemente do custo
+     * de draw_star ou da saída.
+     */
+    uint64_t last = now_ns();
+    uint64_t acc = 0;
+
+    // Saída assíncrona: a thread de saída codifica e entrega os frames;
+    // o primeiro e o de cada mudança de tamanho limpam a tela
+    static FrameRing ring;
+    int async = !cfg.headless && !cfg.sync_output;
+    if(async){
+        stats.dropped = &ring.dropped;
+        writer_start(&ring, &out, &frame);
+    }
+
+    while(!cfg.headless && !quit_pending && (!cfg.max_frames || drawn < cfg.max_frames)){
+        if(resize_pending){
+            resize_pending = 0;
+            fit_terminal(&cfg);
+            frame_resize(&frame, cfg.width, cfg.height);
+            if(frame.glyphs) canvas_resize(&canvas, cfg.width * subx, cfg.height * suby);
+            set_geometry(&geo, cfg.width, cfg.height, cfg.aspect, subx, suby);
+        }
+
+        uint64_t now = now_ns();
+        acc += now - last;
+        last = now;
+        if(acc > MAX_CATCHUP_NS) acc = MAX_CATCHUP_NS;
+
+        int steps = 0;
+        while(acc >= step_ns){
+            advance_star(&s, dt * cfg.speed);
+            acc -= step_ns;
+            steps++;
+        }
+
+        if(steps > 0){
+            uint64_t t1 = now_ns();
+            frame.stats.live = render_frame(&s, &geo, &canvas, &frame, &pool);
+            frame.time_ns = now_ns();
+            frame.stats.render_ns = frame.time_ns - t1;
+            frame.stats.update_ns = t1 - now;
+            frame.stats.steps = steps;
+            frame.stats.frame = drawn;
+            frame.stats.clock = s.clock;
+            if(async) ring_publish(&ring, &frame);
+            else present_frame(&out, &frame);
+            drawn++;
+        }
+
+        if(trace_pending){
+            trace_pending = 0;
+            trace_dump();
+        }
+
+        // Dorme até o próximo passo de física
+        uint64_t elapsed = now_ns() - last;
+        uint64_t due = step_ns - acc;
+        if(elapsed < due){
+            uint64_t wait = due - elapsed;
+            struct timespec ts = { (time_t)(wait / 1000000000u), (long)(wait % 1000000000u) };
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    if(async) writer_stop(&ring);
+    if(cfg.record_path) recorder_close(&rec);
+    cast_close(&cast);
+    stats_close(&stats);
+    trace_dump();
+
+    if(out.fd >= 0) park_cursor(out.fd, &frame, cfg.status);
+
+    pool_destroy(&pool);
     return 0;
 }